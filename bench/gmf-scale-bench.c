@@ -0,0 +1,114 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#include "gmf-scale.h"
+
+// Best of: the first run pays for page faults and the kernel pick
+#define BENCH_RUNS 15
+
+typedef struct _BenchCase BenchCase;
+
+struct _BenchCase
+{
+	const char *name;
+
+	int width;
+	int height;
+	gboolean alpha;
+
+	int icon_size;
+};
+
+// What the thumbnail job scales: camera photos and screenshots, to the view's icon sizes
+static const BenchCase cases[] =
+{
+	{ "photo 12 Mpx",    4000, 3000, FALSE, 256 },
+	{ "photo 12 Mpx",    4000, 3000, FALSE, 128 },
+	{ "screenshot RGBA", 1920, 1080, TRUE,  256 },
+	{ "icon RGBA",       1024, 1024, TRUE,   64 }
+};
+
+// Noise over a pattern: a flat image would flatter both scalers
+static GdkPixbuf * bench_source ( int width, int height, gboolean alpha )
+{
+	GdkPixbuf *pixbuf = gdk_pixbuf_new ( GDK_COLORSPACE_RGB, alpha, 8, width, height );
+
+	int nc = gdk_pixbuf_get_n_channels ( pixbuf );
+	int stride = gdk_pixbuf_get_rowstride ( pixbuf );
+
+	uint8_t *pixels = gdk_pixbuf_get_pixels ( pixbuf );
+
+	uint32_t seed = 1;
+
+	int x = 0, y = 0, c = 0; for ( y = 0; y < height; y++ )
+	{
+		uint8_t *p = pixels + (size_t)y * (size_t)stride;
+
+		for ( x = 0; x < width; x++ )
+			for ( c = 0; c < nc; c++ )
+			{
+				seed = seed * 1664525u + 1013904223u;
+
+				*p++ = (uint8_t)( ( ( x ^ y ) & 0xFF ) / 2 + ( seed >> 25 ) );
+			}
+	}
+
+	return pixbuf;
+}
+
+// Milliseconds of the fastest run
+static double bench_run ( GdkPixbuf *src, int dw, int dh, gboolean gmf )
+{
+	double best = G_MAXDOUBLE;
+
+	int i = 0; for ( i = 0; i < BENCH_RUNS; i++ )
+	{
+		int64_t start = g_get_monotonic_time ();
+
+		GdkPixbuf *dst = ( gmf ) ? gmf_scale_down ( src, dw, dh ) : gdk_pixbuf_scale_simple ( src, dw, dh, GDK_INTERP_BILINEAR );
+
+		double ms = (double)( g_get_monotonic_time () - start ) / 1000;
+
+		if ( dst ) g_object_unref ( dst );
+
+		best = MIN ( best, ms );
+	}
+
+	return best;
+}
+
+int main ( void )
+{
+	g_print ( "gmf_scale_down kernels: %s\n\n", gmf_scale_get_kernels_name () );
+
+	g_print ( "%-16s %11s %6s %10s %10s %9s\n", "case", "source", "icon", "gdk ms", "gmf ms", "speed-up" );
+
+	uint i = 0; for ( i = 0; i < G_N_ELEMENTS ( cases ); i++ )
+	{
+		const BenchCase *bc = &cases[i];
+
+		GdkPixbuf *src = bench_source ( bc->width, bc->height, bc->alpha );
+
+		// The same fit as gmf_thumb_scale
+		double k = (double)bc->icon_size / MAX ( bc->width, bc->height );
+
+		int dw = MAX ( 1, (int)( bc->width * k ) ), dh = MAX ( 1, (int)( bc->height * k ) );
+
+		double gdk = bench_run ( src, dw, dh, FALSE );
+		double gmf = bench_run ( src, dw, dh, TRUE  );
+
+		g_autofree char *size = g_strdup_printf ( "%dx%d", bc->width, bc->height );
+
+		g_print ( "%-16s %11s %6d %10.2f %10.2f %8.1fx\n", bc->name, size, bc->icon_size, gdk, gmf, gdk / gmf );
+
+		g_object_unref ( src );
+	}
+
+	return 0;
+}
@@ -8,6 +8,8 @@
 */
 
 #include "gmf-dialog.h"
+#include "gmf-pixbuf-cache.h"
+#include "gmf-mime.h"
 
 #include <errno.h>
 #include <sys/stat.h>
@@ -83,10 +85,15 @@ static inline GtkIconInfo * get_icon_info ( const char *content_type, gboolean i
 
 GdkPixbuf * get_pixbuf ( const char *path, gboolean is_link, uint16_t icon_size )
 {
-	GdkPixbuf *pixbuf = NULL;
+	GmfPixbufKey key;
+
+	// Only reuse what the views decoded: the generic icons below must not end up in the cache
+	GdkPixbuf *pixbuf = ( gmf_pixbuf_key_init ( path, is_link, icon_size, 1, &key ) ) ? gmf_pixbuf_cache_lookup ( &key ) : NULL;
+
+	if ( pixbuf ) return pixbuf;
 
 	GFile *file = g_file_new_for_path ( path );
-	GFileInfo *finfo = g_file_query_info ( file, "*", 0, NULL, NULL );
+	GFileInfo *finfo = gmf_mime_query_info ( file, G_FILE_ATTRIBUTE_STANDARD_TYPE );
 
 	gboolean is_dir = g_file_test ( path, G_FILE_TEST_IS_DIR );
 	const char *content_type = ( finfo ) ? g_file_info_get_content_type ( finfo ) : NULL;
@@ -220,7 +227,7 @@ static void gmf_launch_app ( GFile *file, GtkWindow *window )
 
 	list = g_list_append ( list, file );
 
-	GFileInfo *file_info = g_file_query_info ( file, "standard::*", 0, NULL, NULL );
+	GFileInfo *file_info = g_file_query_info ( file, G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE, 0, NULL, NULL );
 
 	const char *content_type = ( file_info ) ? g_file_info_get_content_type ( file_info ) : NULL;
 
@@ -238,7 +245,7 @@ static void gmf_launch_app ( GFile *file, GtkWindow *window )
 
 void gmf_activated_file ( GFile *file, GtkWindow *window )
 {
-	GFileInfo *file_info = g_file_query_info ( file, "standard::*", 0, NULL, NULL );
+	GFileInfo *file_info = g_file_query_info ( file, G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE, 0, NULL, NULL );
 
 	if ( file_info )
 	{
@@ -358,7 +365,7 @@ void gmf_dialog_recent ( GtkWindow *win_base )
 
 static void gmf_trash_treeview_add ( const char *name, const char *path, GFile *file, GtkListStore *store )
 {
-	GFileInfo *info = g_file_query_info ( file, "*", 0, NULL, NULL );
+	GFileInfo *info = g_file_query_info ( file, G_FILE_ATTRIBUTE_STANDARD_ICON, 0, NULL, NULL );
 
 	GIcon *icon = ( info ) ? g_file_info_get_icon ( info ) : NULL;
 
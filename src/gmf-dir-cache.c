@@ -0,0 +1,166 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#include "gmf-dir-cache.h"
+
+#include <sys/stat.h>
+
+#define CACHE_SIZE 8
+
+typedef struct _CacheNode CacheNode;
+
+struct _CacheNode
+{
+	GmfDirList *list;
+	GFileMonitor *monitor;
+};
+
+// Main thread only: the loader threads just build GmfDirList and hand it over
+static GQueue cache_lru = G_QUEUE_INIT;
+static GHashTable *cache_table = NULL;
+static uint cache_size = CACHE_SIZE;
+
+// ***** List *****
+
+GmfDirList * gmf_dir_list_new ( const char *path, enum sort_enm sort, gboolean hidden )
+{
+	GmfDirList *list = g_new0 ( GmfDirList, 1 );
+
+	list->ref = 1;
+	list->path = g_strdup ( path );
+	list->sort = sort;
+	list->hidden = hidden;
+	list->entries = g_ptr_array_new_with_free_func ( (GDestroyNotify)gmf_dir_entry_free );
+
+	return list;
+}
+
+GmfDirList * gmf_dir_list_ref ( GmfDirList *list )
+{
+	g_atomic_int_inc ( &list->ref );
+
+	return list;
+}
+
+void gmf_dir_list_unref ( GmfDirList *list )
+{
+	if ( !g_atomic_int_dec_and_test ( &list->ref ) ) return;
+
+	g_ptr_array_unref ( list->entries );
+
+	free ( list->path );
+	free ( list );
+}
+
+// ***** Cache *****
+
+int64_t gmf_dir_cache_mtime ( const char *path )
+{
+	struct stat st;
+
+	if ( stat ( path, &st ) != 0 ) return -1;
+
+	return (int64_t)st.st_mtim.tv_sec * G_USEC_PER_SEC * 1000 + st.st_mtim.tv_nsec;
+}
+
+static void gmf_dir_cache_node_free ( CacheNode *node )
+{
+	if ( node->monitor )
+	{
+		g_signal_handlers_disconnect_by_data ( node->monitor, node );
+
+		g_file_monitor_cancel ( node->monitor );
+
+		g_object_unref ( node->monitor );
+	}
+
+	gmf_dir_list_unref ( node->list );
+
+	free ( node );
+}
+
+static void gmf_dir_cache_remove ( GList *link )
+{
+	CacheNode *node = (CacheNode *)link->data;
+
+	g_hash_table_remove ( cache_table, node->list->path );
+	g_queue_delete_link ( &cache_lru, link );
+
+	gmf_dir_cache_node_free ( node );
+}
+
+static void gmf_dir_cache_changed ( G_GNUC_UNUSED GFileMonitor *monitor, G_GNUC_UNUSED GFile *file, G_GNUC_UNUSED GFile *other, G_GNUC_UNUSED GFileMonitorEvent evtype, CacheNode *node )
+{
+	gmf_dir_cache_invalidate ( node->list->path );
+}
+
+static void gmf_dir_cache_trim ( void )
+{
+	while ( cache_lru.length > cache_size ) gmf_dir_cache_remove ( g_queue_peek_tail_link ( &cache_lru ) );
+}
+
+void gmf_dir_cache_set_size ( uint size )
+{
+	cache_size = size;
+
+	if ( cache_table ) gmf_dir_cache_trim ();
+}
+
+GmfDirList * gmf_dir_cache_lookup ( const char *path, enum sort_enm sort, gboolean hidden )
+{
+	if ( !cache_table ) return NULL;
+
+	GList *link = g_hash_table_lookup ( cache_table, path );
+
+	if ( !link ) return NULL;
+
+	CacheNode *node = (CacheNode *)link->data;
+
+	// The monitor drops a listing as soon as anything changes; the mtime covers file systems without one
+	if ( node->list->mtime != gmf_dir_cache_mtime ( path ) ) { gmf_dir_cache_remove ( link ); return NULL; }
+
+	if ( node->list->sort != sort || node->list->hidden != hidden ) return NULL;
+
+	g_queue_unlink ( &cache_lru, link );
+	g_queue_push_head_link ( &cache_lru, link );
+
+	return gmf_dir_list_ref ( node->list );
+}
+
+void gmf_dir_cache_insert ( GmfDirList *list )
+{
+	if ( !cache_size || list->mtime < 0 ) return;
+
+	if ( !cache_table ) cache_table = g_hash_table_new ( g_str_hash, g_str_equal );
+
+	gmf_dir_cache_invalidate ( list->path );
+
+	CacheNode *node = g_new0 ( CacheNode, 1 );
+	node->list = gmf_dir_list_ref ( list );
+
+	GFile *file = g_file_new_for_path ( list->path );
+	node->monitor = g_file_monitor_directory ( file, G_FILE_MONITOR_WATCH_MOVES, NULL, NULL );
+	g_object_unref ( file );
+
+	if ( node->monitor ) g_signal_connect ( node->monitor, "changed", G_CALLBACK ( gmf_dir_cache_changed ), node );
+
+	g_queue_push_head ( &cache_lru, node );
+	g_hash_table_insert ( cache_table, node->list->path, g_queue_peek_head_link ( &cache_lru ) );
+
+	gmf_dir_cache_trim ();
+}
+
+void gmf_dir_cache_invalidate ( const char *path )
+{
+	if ( !cache_table ) return;
+
+	GList *link = g_hash_table_lookup ( cache_table, path );
+
+	if ( link ) gmf_dir_cache_remove ( link );
+}
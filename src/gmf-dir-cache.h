@@ -0,0 +1,39 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#pragma once
+
+#include "gmf-dir.h"
+
+typedef struct _GmfDirList GmfDirList;
+
+struct _GmfDirList
+{
+	int ref;
+
+	char *path;
+	int64_t mtime;
+
+	gboolean hidden;
+	enum sort_enm sort;
+
+	GPtrArray *entries;
+};
+
+GmfDirList * gmf_dir_list_new ( const char *, enum sort_enm, gboolean );
+GmfDirList * gmf_dir_list_ref ( GmfDirList * );
+void gmf_dir_list_unref ( GmfDirList * );
+
+int64_t gmf_dir_cache_mtime ( const char * );
+
+void gmf_dir_cache_set_size ( uint );
+
+GmfDirList * gmf_dir_cache_lookup ( const char *, enum sort_enm, gboolean );
+void gmf_dir_cache_insert ( GmfDirList * );
+void gmf_dir_cache_invalidate ( const char * );
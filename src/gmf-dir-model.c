@@ -0,0 +1,656 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#include "gmf-dir-model.h"
+
+#include <cairo-gobject.h>
+
+enum item_flags
+{
+	ITEM_IS_DIR    = 1 << 0,
+	ITEM_IS_LINK   = 1 << 1,
+	ITEM_IS_PIXBUF = 1 << 2,
+	ITEM_IS_PREVIEW = 1 << 3,
+	ITEM_ATTEMPTED = 1 << 4,
+	ITEM_IS_REGULAR = 1 << 5
+};
+
+#define ITEM_DECODED ( ITEM_IS_PIXBUF | ITEM_IS_PREVIEW )
+#define ITEM_TYPE ( ITEM_IS_DIR | ITEM_IS_LINK | ITEM_IS_REGULAR )
+
+typedef struct _GmfDirItem GmfDirItem;
+
+// One row: the path and the strings for the view are built from it on demand
+struct _GmfDirItem
+{
+	char *name;
+	char *display;
+
+	GdkPixbuf *pixbuf;
+
+	// The pixbuf at the view's scale, made when the row is first drawn; a shared pixbuf keeps its own
+	cairo_surface_t *surface;
+
+	// What the listing stat'ed: the thumbnail job keys on it instead of stat'ing the file again
+	uint64_t dev;
+	uint64_t inode;
+	uint64_t size;
+	int64_t mtime;
+	uint32_t mtime_nsec;
+	uint8_t flags;
+};
+
+struct _GmfDirModel
+{
+	GObject parent_instance;
+
+	char *dir;
+	GArray *items;
+
+	// Pixbufs decoded for the rows: thumbnails and previews
+	uint64_t bytes;
+
+	// Pixbufs are in device pixels: scale of them to a logical pixel
+	int scale;
+
+	int stamp;
+};
+
+static void gmf_dir_model_tree_model_init ( GtkTreeModelIface * );
+static void gmf_dir_model_drag_source_init ( GtkTreeDragSourceIface * );
+static void gmf_dir_model_drag_dest_init ( GtkTreeDragDestIface * );
+
+G_DEFINE_TYPE_WITH_CODE ( GmfDirModel, gmf_dir_model, G_TYPE_OBJECT,
+	G_IMPLEMENT_INTERFACE ( GTK_TYPE_TREE_MODEL, gmf_dir_model_tree_model_init )
+	G_IMPLEMENT_INTERFACE ( GTK_TYPE_TREE_DRAG_SOURCE, gmf_dir_model_drag_source_init )
+	G_IMPLEMENT_INTERFACE ( GTK_TYPE_TREE_DRAG_DEST, gmf_dir_model_drag_dest_init ) )
+
+#define ITEM(model, indx) ( &g_array_index ( (model)->items, GmfDirItem, (indx) ) )
+#define ITER_INDX(iter) ( GPOINTER_TO_UINT ( (iter)->user_data ) )
+
+static void gmf_dir_item_clear ( GmfDirItem *item )
+{
+	free ( item->name );
+	free ( item->display );
+
+	if ( item->pixbuf ) g_object_unref ( item->pixbuf );
+	if ( item->surface ) cairo_surface_destroy ( item->surface );
+}
+
+static uint8_t gmf_dir_item_type_flags ( const GmfDirEntry *entry )
+{
+	return (uint8_t)( ( entry->is_dir ? ITEM_IS_DIR : 0 ) | ( entry->is_link ? ITEM_IS_LINK : 0 ) | ( entry->is_regular ? ITEM_IS_REGULAR : 0 ) );
+}
+
+// Placeholders and theme icons are shown by many rows: none of their memory is the row's own
+static uint64_t gmf_dir_item_bytes ( const GmfDirItem *item )
+{
+	if ( !item->pixbuf || !( item->flags & ITEM_DECODED ) || gmf_pixbuf_is_shared ( item->pixbuf ) ) return 0;
+
+	uint64_t bytes = gdk_pixbuf_get_byte_length ( item->pixbuf );
+
+	if ( item->surface ) bytes += (uint64_t)cairo_image_surface_get_stride ( item->surface ) * (uint64_t)cairo_image_surface_get_height ( item->surface );
+
+	return bytes;
+}
+
+static void gmf_dir_model_item_drop_surface ( GmfDirModel *model, GmfDirItem *item )
+{
+	if ( !item->surface ) return;
+
+	model->bytes -= gmf_dir_item_bytes ( item );
+
+	cairo_surface_destroy ( item->surface );
+	item->surface = NULL;
+
+	model->bytes += gmf_dir_item_bytes ( item );
+}
+
+// state: ITEM_IS_PIXBUF, ITEM_IS_PREVIEW or 0 for a placeholder, which is due for a thumbnail again
+static void gmf_dir_model_item_set_pixbuf ( GmfDirModel *model, GmfDirItem *item, GdkPixbuf *pixbuf, uint8_t state )
+{
+	gmf_dir_model_item_drop_surface ( model, item );
+
+	model->bytes -= gmf_dir_item_bytes ( item );
+
+	if ( pixbuf ) g_object_ref ( pixbuf );
+	if ( item->pixbuf ) g_object_unref ( item->pixbuf );
+
+	item->pixbuf = pixbuf;
+	item->flags = (uint8_t)( ( item->flags & ~( ( state ) ? ITEM_DECODED : ITEM_DECODED | ITEM_ATTEMPTED ) ) | state );
+
+	model->bytes += gmf_dir_item_bytes ( item );
+}
+
+static gboolean gmf_dir_model_set_iter ( GmfDirModel *model, uint indx, GtkTreeIter *iter )
+{
+	if ( indx >= model->items->len ) { iter->stamp = 0; return FALSE; }
+
+	iter->stamp = model->stamp;
+	iter->user_data = GUINT_TO_POINTER ( indx );
+
+	return TRUE;
+}
+
+// ***** GtkTreeModel *****
+
+static GtkTreeModelFlags gmf_dir_model_get_flags ( G_GNUC_UNUSED GtkTreeModel *tree_model )
+{
+	return GTK_TREE_MODEL_LIST_ONLY;
+}
+
+static int gmf_dir_model_get_n_columns ( G_GNUC_UNUSED GtkTreeModel *tree_model )
+{
+	return NUM_COLS;
+}
+
+static GType gmf_dir_model_get_column_type ( G_GNUC_UNUSED GtkTreeModel *tree_model, int col )
+{
+	GType types[] = { G_TYPE_STRING, G_TYPE_STRING, G_TYPE_BOOLEAN, G_TYPE_BOOLEAN, G_TYPE_BOOLEAN, GDK_TYPE_PIXBUF, G_TYPE_UINT64, CAIRO_GOBJECT_TYPE_SURFACE };
+
+	g_return_val_if_fail ( col >= 0 && col < NUM_COLS, G_TYPE_INVALID );
+
+	return types[col];
+}
+
+static gboolean gmf_dir_model_get_iter ( GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreePath *path )
+{
+	GmfDirModel *model = GMF_DIR_MODEL ( tree_model );
+
+	if ( gtk_tree_path_get_depth ( path ) != 1 ) { iter->stamp = 0; return FALSE; }
+
+	int indx = gtk_tree_path_get_indices ( path )[0];
+
+	return gmf_dir_model_set_iter ( model, (uint)indx, iter );
+}
+
+static GtkTreePath * gmf_dir_model_get_path ( GtkTreeModel *tree_model, GtkTreeIter *iter )
+{
+	GmfDirModel *model = GMF_DIR_MODEL ( tree_model );
+
+	g_return_val_if_fail ( iter->stamp == model->stamp, NULL );
+
+	return gtk_tree_path_new_from_indices ( (int)ITER_INDX ( iter ), -1 );
+}
+
+// One surface per shared pixbuf and scale, on the pixbuf: a folder of 40k placeholders draws from one
+static cairo_surface_t * gmf_dir_model_shared_surface ( GdkPixbuf *pixbuf, int scale )
+{
+	char name[32];
+	g_snprintf ( name, sizeof ( name ), "gmf-dir-model-surface-%d", scale );
+
+	GQuark quark = g_quark_from_string ( name );
+
+	cairo_surface_t *surface = g_object_get_qdata ( G_OBJECT ( pixbuf ), quark );
+
+	if ( surface ) return surface;
+
+	surface = gdk_cairo_surface_create_from_pixbuf ( pixbuf, scale, NULL );
+
+	g_object_set_qdata_full ( G_OBJECT ( pixbuf ), quark, surface, (GDestroyNotify)cairo_surface_destroy );
+
+	return surface;
+}
+
+/* A surface at the model's scale, so that a pixbuf of icon size x scale pixels is drawn sharp in
+ * icon size logical pixels. Made once per pixbuf, not on every draw as the pixbuf cell renderer does. */
+static cairo_surface_t * gmf_dir_model_item_get_surface ( GmfDirModel *model, GmfDirItem *item )
+{
+	if ( item->surface || !item->pixbuf ) return item->surface;
+
+	if ( gmf_pixbuf_is_shared ( item->pixbuf ) ) return gmf_dir_model_shared_surface ( item->pixbuf, model->scale );
+
+	model->bytes -= gmf_dir_item_bytes ( item );
+
+	item->surface = gdk_cairo_surface_create_from_pixbuf ( item->pixbuf, model->scale, NULL );
+
+	model->bytes += gmf_dir_item_bytes ( item );
+
+	return item->surface;
+}
+
+static void gmf_dir_model_get_value ( GtkTreeModel *tree_model, GtkTreeIter *iter, int col, GValue *value )
+{
+	GmfDirModel *model = GMF_DIR_MODEL ( tree_model );
+
+	g_return_if_fail ( iter->stamp == model->stamp && col >= 0 && col < NUM_COLS );
+
+	GmfDirItem *item = ITEM ( model, ITER_INDX ( iter ) );
+
+	g_value_init ( value, gmf_dir_model_get_column_type ( tree_model, col ) );
+
+	switch ( col )
+	{
+		case COL_PATH:      g_value_take_string ( value, g_build_filename ( model->dir, item->name, NULL ) ); break;
+		case COL_NAME:      g_value_set_string  ( value, ( item->display ) ? item->display : item->name ); break;
+		case COL_IS_DIR:    g_value_set_boolean ( value, ( item->flags & ITEM_IS_DIR    ) != 0 ); break;
+		case COL_IS_LINK:   g_value_set_boolean ( value, ( item->flags & ITEM_IS_LINK   ) != 0 ); break;
+		case COL_IS_PIXBUF: g_value_set_boolean ( value, ( item->flags & ITEM_IS_PIXBUF ) != 0 ); break;
+		case COL_PIXBUF:    g_value_set_object  ( value, item->pixbuf ); break;
+		case COL_SIZE:      g_value_set_uint64  ( value, item->size ); break;
+		case COL_SURFACE:   g_value_set_boxed   ( value, gmf_dir_model_item_get_surface ( model, item ) ); break;
+
+		default: break;
+	}
+}
+
+static gboolean gmf_dir_model_iter_next ( GtkTreeModel *tree_model, GtkTreeIter *iter )
+{
+	GmfDirModel *model = GMF_DIR_MODEL ( tree_model );
+
+	g_return_val_if_fail ( iter->stamp == model->stamp, FALSE );
+
+	return gmf_dir_model_set_iter ( model, ITER_INDX ( iter ) + 1, iter );
+}
+
+static gboolean gmf_dir_model_iter_previous ( GtkTreeModel *tree_model, GtkTreeIter *iter )
+{
+	GmfDirModel *model = GMF_DIR_MODEL ( tree_model );
+
+	g_return_val_if_fail ( iter->stamp == model->stamp, FALSE );
+
+	if ( ITER_INDX ( iter ) == 0 ) { iter->stamp = 0; return FALSE; }
+
+	return gmf_dir_model_set_iter ( model, ITER_INDX ( iter ) - 1, iter );
+}
+
+static gboolean gmf_dir_model_iter_nth_child ( GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreeIter *parent, int n )
+{
+	GmfDirModel *model = GMF_DIR_MODEL ( tree_model );
+
+	if ( parent || n < 0 ) { iter->stamp = 0; return FALSE; }
+
+	return gmf_dir_model_set_iter ( model, (uint)n, iter );
+}
+
+static gboolean gmf_dir_model_iter_children ( GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreeIter *parent )
+{
+	return gmf_dir_model_iter_nth_child ( tree_model, iter, parent, 0 );
+}
+
+static gboolean gmf_dir_model_iter_has_child ( G_GNUC_UNUSED GtkTreeModel *tree_model, G_GNUC_UNUSED GtkTreeIter *iter )
+{
+	return FALSE;
+}
+
+static int gmf_dir_model_iter_n_children ( GtkTreeModel *tree_model, GtkTreeIter *iter )
+{
+	GmfDirModel *model = GMF_DIR_MODEL ( tree_model );
+
+	return ( iter ) ? 0 : (int)model->items->len;
+}
+
+static gboolean gmf_dir_model_iter_parent ( G_GNUC_UNUSED GtkTreeModel *tree_model, GtkTreeIter *iter, G_GNUC_UNUSED GtkTreeIter *child )
+{
+	iter->stamp = 0;
+
+	return FALSE;
+}
+
+static void gmf_dir_model_tree_model_init ( GtkTreeModelIface *iface )
+{
+	iface->get_flags       = gmf_dir_model_get_flags;
+	iface->get_n_columns   = gmf_dir_model_get_n_columns;
+	iface->get_column_type = gmf_dir_model_get_column_type;
+	iface->get_iter        = gmf_dir_model_get_iter;
+	iface->get_path        = gmf_dir_model_get_path;
+	iface->get_value       = gmf_dir_model_get_value;
+	iface->iter_next       = gmf_dir_model_iter_next;
+	iface->iter_previous   = gmf_dir_model_iter_previous;
+	iface->iter_children   = gmf_dir_model_iter_children;
+	iface->iter_has_child  = gmf_dir_model_iter_has_child;
+	iface->iter_n_children = gmf_dir_model_iter_n_children;
+	iface->iter_nth_child  = gmf_dir_model_iter_nth_child;
+	iface->iter_parent     = gmf_dir_model_iter_parent;
+}
+
+// ***** Drag and Drop *****
+
+// The icon view only starts a drag or accepts a drop on models with these interfaces; the files themselves are handled by the window
+
+static gboolean gmf_dir_model_row_draggable ( G_GNUC_UNUSED GtkTreeDragSource *source, G_GNUC_UNUSED GtkTreePath *path )
+{
+	return TRUE;
+}
+
+static gboolean gmf_dir_model_drag_data_get ( GtkTreeDragSource *source, GtkTreePath *path, GtkSelectionData *sd )
+{
+	return gtk_tree_set_row_drag_data ( sd, GTK_TREE_MODEL ( source ), path );
+}
+
+static gboolean gmf_dir_model_drag_data_delete ( G_GNUC_UNUSED GtkTreeDragSource *source, G_GNUC_UNUSED GtkTreePath *path )
+{
+	return FALSE;
+}
+
+static void gmf_dir_model_drag_source_init ( GtkTreeDragSourceIface *iface )
+{
+	iface->row_draggable    = gmf_dir_model_row_draggable;
+	iface->drag_data_get    = gmf_dir_model_drag_data_get;
+	iface->drag_data_delete = gmf_dir_model_drag_data_delete;
+}
+
+static gboolean gmf_dir_model_drag_data_received ( G_GNUC_UNUSED GtkTreeDragDest *dest, G_GNUC_UNUSED GtkTreePath *path, G_GNUC_UNUSED GtkSelectionData *sd )
+{
+	return FALSE;
+}
+
+static gboolean gmf_dir_model_row_drop_possible ( GtkTreeDragDest *dest, GtkTreePath *path, G_GNUC_UNUSED GtkSelectionData *sd )
+{
+	GmfDirModel *model = GMF_DIR_MODEL ( dest );
+
+	if ( gtk_tree_path_get_depth ( path ) != 1 ) return FALSE;
+
+	int indx = gtk_tree_path_get_indices ( path )[0];
+
+	return ( indx >= 0 && (uint)indx <= model->items->len );
+}
+
+static void gmf_dir_model_drag_dest_init ( GtkTreeDragDestIface *iface )
+{
+	iface->drag_data_received = gmf_dir_model_drag_data_received;
+	iface->row_drop_possible  = gmf_dir_model_row_drop_possible;
+}
+
+// ***** Rows *****
+
+const char * gmf_dir_model_get_dir ( GmfDirModel *model )
+{
+	return model->dir;
+}
+
+void gmf_dir_model_insert ( GmfDirModel *model, int pos, const GmfDirEntry *entry, gboolean is_pixbuf, GdkPixbuf *pixbuf )
+{
+	GmfDirItem item;
+
+	item.name    = g_strdup ( entry->name );
+	item.display = ( g_str_equal ( entry->name, entry->display_name ) ) ? NULL : g_strdup ( entry->display_name );
+	item.pixbuf  = ( pixbuf ) ? g_object_ref ( pixbuf ) : NULL;
+	item.surface = NULL;
+	item.dev     = entry->dev;
+	item.inode   = entry->inode;
+	item.size    = entry->size;
+	item.mtime   = entry->mtime;
+	item.mtime_nsec = entry->mtime_nsec;
+
+	item.flags = (uint8_t)( gmf_dir_item_type_flags ( entry ) | ( is_pixbuf ? ITEM_IS_PIXBUF : 0 ) );
+
+	uint indx = ( pos < 0 || (uint)pos > model->items->len ) ? model->items->len : (uint)pos;
+
+	if ( indx == model->items->len )
+		g_array_append_val ( model->items, item );
+	else
+		g_array_insert_val ( model->items, indx, item );
+
+	model->bytes += gmf_dir_item_bytes ( &item );
+
+	model->stamp++;
+
+	GtkTreeIter iter;
+	gmf_dir_model_set_iter ( model, indx, &iter );
+
+	GtkTreePath *path = gtk_tree_path_new_from_indices ( (int)indx, -1 );
+	gtk_tree_model_row_inserted ( GTK_TREE_MODEL ( model ), path, &iter );
+	gtk_tree_path_free ( path );
+}
+
+void gmf_dir_model_remove ( GmfDirModel *model, GtkTreeIter *iter )
+{
+	g_return_if_fail ( iter->stamp == model->stamp );
+
+	uint indx = ITER_INDX ( iter );
+
+	model->bytes -= gmf_dir_item_bytes ( ITEM ( model, indx ) );
+
+	gmf_dir_item_clear ( ITEM ( model, indx ) );
+	g_array_remove_index ( model->items, indx );
+
+	model->stamp++;
+	iter->stamp = 0;
+
+	GtkTreePath *path = gtk_tree_path_new_from_indices ( (int)indx, -1 );
+	gtk_tree_model_row_deleted ( GTK_TREE_MODEL ( model ), path );
+	gtk_tree_path_free ( path );
+}
+
+// new_order[new position] = old position, as in gtk_list_store_reorder
+void gmf_dir_model_reorder ( GmfDirModel *model, const int *new_order )
+{
+	uint len = model->items->len;
+
+	if ( len < 2 ) return;
+
+	GmfDirItem *old = g_new ( GmfDirItem, len );
+	memcpy ( old, model->items->data, len * sizeof ( GmfDirItem ) );
+
+	uint i = 0; for ( i = 0; i < len; i++ ) *ITEM ( model, i ) = old[new_order[i]];
+
+	free ( old );
+
+	model->stamp++;
+
+	GtkTreePath *path = gtk_tree_path_new ();
+	gtk_tree_model_rows_reordered ( GTK_TREE_MODEL ( model ), path, NULL, (int *)new_order );
+	gtk_tree_path_free ( path );
+}
+
+void gmf_dir_model_set_pixbuf ( GmfDirModel *model, GtkTreeIter *iter, GdkPixbuf *pixbuf )
+{
+	g_return_if_fail ( iter->stamp == model->stamp );
+
+	gmf_dir_model_item_set_pixbuf ( model, ITEM ( model, ITER_INDX ( iter ) ), pixbuf, ITEM_IS_PIXBUF );
+
+	GtkTreePath *path = gtk_tree_path_new_from_indices ( (int)ITER_INDX ( iter ), -1 );
+	gtk_tree_model_row_changed ( GTK_TREE_MODEL ( model ), path, iter );
+	gtk_tree_path_free ( path );
+}
+
+// For a pixbuf that fits the cell already laid out: the row is not re-measured, the caller redraws the view
+void gmf_dir_model_set_pixbuf_quiet ( GmfDirModel *model, GtkTreeIter *iter, GdkPixbuf *pixbuf )
+{
+	g_return_if_fail ( iter->stamp == model->stamp );
+
+	gmf_dir_model_item_set_pixbuf ( model, ITEM ( model, ITER_INDX ( iter ) ), pixbuf, ITEM_IS_PIXBUF );
+}
+
+// A low-resolution stand-in: the row still counts as not having its pixbuf
+void gmf_dir_model_set_preview ( GmfDirModel *model, GtkTreeIter *iter, GdkPixbuf *pixbuf )
+{
+	g_return_if_fail ( iter->stamp == model->stamp );
+
+	GmfDirItem *item = ITEM ( model, ITER_INDX ( iter ) );
+
+	if ( item->flags & ITEM_IS_PIXBUF ) return;
+
+	gmf_dir_model_item_set_pixbuf ( model, item, pixbuf, ITEM_IS_PREVIEW );
+}
+
+/* Every row back to the placeholder of its kind, for a new icon size; is_pixbuf marks them final.
+ * No signals: the caller sets the model on the view again, so that every row is measured once. */
+void gmf_dir_model_reset_pixbufs ( GmfDirModel *model, gboolean is_pixbuf, GdkPixbuf *pixbuf_dir, GdkPixbuf *pixbuf_file )
+{
+	uint i = 0; for ( i = 0; i < model->items->len; i++ )
+	{
+		GmfDirItem *item = ITEM ( model, i );
+
+		gmf_dir_model_item_set_pixbuf ( model, item, ( item->flags & ITEM_IS_DIR ) ? pixbuf_dir : pixbuf_file, ( is_pixbuf ) ? ITEM_IS_PIXBUF : 0 );
+	}
+}
+
+// The view's scale factor: the pixbufs set after this are icon size x scale pixels
+void gmf_dir_model_set_scale ( GmfDirModel *model, int scale )
+{
+	if ( model->scale == scale ) return;
+
+	model->scale = scale;
+
+	uint i = 0; for ( i = 0; i < model->items->len; i++ ) gmf_dir_model_item_drop_surface ( model, ITEM ( model, i ) );
+}
+
+uint64_t gmf_dir_model_get_bytes ( GmfDirModel *model )
+{
+	return model->bytes;
+}
+
+/* Swap decoded pixbufs back to the placeholders, farthest rows from [keep_start, keep_end) first,
+ * until the model holds no more than limit bytes. Rows are not re-measured: the caller redraws. */
+uint gmf_dir_model_evict ( GmfDirModel *model, uint keep_start, uint keep_end, uint64_t limit, GdkPixbuf *pixbuf_dir, GdkPixbuf *pixbuf_file )
+{
+	uint n = 0, lo = 0, hi = model->items->len;
+
+	keep_end = MIN ( keep_end, hi );
+	keep_start = MIN ( keep_start, keep_end );
+
+	while ( model->bytes > limit && ( lo < keep_start || hi > keep_end ) )
+	{
+		uint indx = ( lo < keep_start && ( hi <= keep_end || keep_start - lo >= hi - keep_end ) ) ? lo++ : --hi;
+
+		GmfDirItem *item = ITEM ( model, indx );
+
+		// Nothing is saved by a placeholder in place of a shared icon, and the row would only be decoded again
+		if ( !( item->flags & ITEM_DECODED ) || gmf_pixbuf_is_shared ( item->pixbuf ) ) continue;
+
+		gmf_dir_model_item_set_pixbuf ( model, item, ( item->flags & ITEM_IS_DIR ) ? pixbuf_dir : pixbuf_file, 0 );
+
+		n++;
+	}
+
+	return n;
+}
+
+// A thumbnail job has been through the row: whatever it got, a new job would get the same
+void gmf_dir_model_set_attempted ( GmfDirModel *model, GtkTreeIter *iter )
+{
+	g_return_if_fail ( iter->stamp == model->stamp );
+
+	ITEM ( model, ITER_INDX ( iter ) )->flags |= ITEM_ATTEMPTED;
+}
+
+// Neither a pixbuf of its own nor a job that tried since it was inserted, evicted or changed
+gboolean gmf_dir_model_is_due ( GmfDirModel *model, GtkTreeIter *iter )
+{
+	g_return_val_if_fail ( iter->stamp == model->stamp, FALSE );
+
+	return !( ITEM ( model, ITER_INDX ( iter ) )->flags & ( ITEM_IS_PIXBUF | ITEM_ATTEMPTED ) );
+}
+
+// The row's thumbnail cache key, from the listing's stat, as gmf_pixbuf_key_init_entry makes it
+gboolean gmf_dir_model_get_key ( GmfDirModel *model, GtkTreeIter *iter, uint16_t icon_size, uint8_t scale, GmfPixbufKey *key )
+{
+	g_return_val_if_fail ( iter->stamp == model->stamp, FALSE );
+
+	GmfDirItem *item = ITEM ( model, ITER_INDX ( iter ) );
+
+	memset ( key, 0, sizeof ( GmfPixbufKey ) );
+
+	key->icon_size = icon_size;
+	key->scale = scale;
+	key->is_link = ( item->flags & ITEM_IS_LINK ) != 0;
+
+	if ( !item->inode ) return FALSE;
+
+	key->dev   = item->dev;
+	key->inode = item->inode;
+	key->size  = item->size;
+	key->mtime = item->mtime * G_USEC_PER_SEC * 1000 + item->mtime_nsec;
+
+	return TRUE;
+}
+
+// Only a regular file is opened to sniff it: a FIFO would block, a device may act on the open
+gboolean gmf_dir_model_is_regular ( GmfDirModel *model, GtkTreeIter *iter )
+{
+	g_return_val_if_fail ( iter->stamp == model->stamp, FALSE );
+
+	return ( ITEM ( model, ITER_INDX ( iter ) )->flags & ITEM_IS_REGULAR ) != 0;
+}
+
+const char * gmf_dir_model_get_name ( GmfDirModel *model, GtkTreeIter *iter )
+{
+	g_return_val_if_fail ( iter->stamp == model->stamp, NULL );
+
+	return ITEM ( model, ITER_INDX ( iter ) )->name;
+}
+
+// Returns TRUE when the row described a different file; its stale pixbuf is then replaced, as by an insert
+gboolean gmf_dir_model_update ( GmfDirModel *model, GtkTreeIter *iter, const GmfDirEntry *entry, gboolean is_pixbuf, GdkPixbuf *pixbuf )
+{
+	g_return_val_if_fail ( iter->stamp == model->stamp, FALSE );
+
+	GmfDirItem *item = ITEM ( model, ITER_INDX ( iter ) );
+
+	uint8_t flags = gmf_dir_item_type_flags ( entry );
+
+	if ( item->dev == entry->dev && item->inode == entry->inode && item->size == entry->size && item->mtime == entry->mtime
+		&& item->mtime_nsec == entry->mtime_nsec && ( item->flags & ITEM_TYPE ) == flags ) return FALSE;
+
+	item->dev   = entry->dev;
+	item->inode = entry->inode;
+	item->size  = entry->size;
+	item->mtime = entry->mtime;
+	item->mtime_nsec = entry->mtime_nsec;
+	item->flags = (uint8_t)( ( item->flags & ~ITEM_TYPE ) | flags );
+
+	gmf_dir_model_item_set_pixbuf ( model, item, pixbuf, ( is_pixbuf ) ? ITEM_IS_PIXBUF : 0 );
+
+	GtkTreePath *path = gtk_tree_path_new_from_indices ( (int)ITER_INDX ( iter ), -1 );
+	gtk_tree_model_row_changed ( GTK_TREE_MODEL ( model ), path, iter );
+	gtk_tree_path_free ( path );
+
+	return TRUE;
+}
+
+// Look a file up by its name in the directory, without building a path per row
+gboolean gmf_dir_model_find ( GmfDirModel *model, const char *name, GtkTreeIter *iter )
+{
+	uint i = 0; for ( i = 0; i < model->items->len; i++ )
+	{
+		if ( g_str_equal ( ITEM ( model, i )->name, name ) ) return gmf_dir_model_set_iter ( model, i, iter );
+	}
+
+	iter->stamp = 0;
+
+	return FALSE;
+}
+
+static void gmf_dir_model_init ( GmfDirModel *model )
+{
+	model->items = g_array_new ( FALSE, FALSE, sizeof ( GmfDirItem ) );
+	model->stamp = (int)g_random_int ();
+	model->scale = 1;
+}
+
+static void gmf_dir_model_finalize ( GObject *object )
+{
+	GmfDirModel *model = GMF_DIR_MODEL ( object );
+
+	uint i = 0; for ( i = 0; i < model->items->len; i++ ) gmf_dir_item_clear ( ITEM ( model, i ) );
+
+	g_array_free ( model->items, TRUE );
+
+	free ( model->dir );
+
+	G_OBJECT_CLASS (gmf_dir_model_parent_class)->finalize (object);
+}
+
+static void gmf_dir_model_class_init ( GmfDirModelClass *class )
+{
+	GObjectClass *oclass = G_OBJECT_CLASS (class);
+
+	oclass->finalize = gmf_dir_model_finalize;
+}
+
+GmfDirModel * gmf_dir_model_new ( const char *dir )
+{
+	GmfDirModel *model = g_object_new ( GMF_TYPE_DIR_MODEL, NULL );
+
+	model->dir = g_strdup ( ( dir ) ? dir : "" );
+
+	return model;
+}
@@ -0,0 +1,59 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#pragma once
+
+#include "gmf-dir.h"
+#include "gmf-pixbuf-cache.h"
+
+enum cols_enm
+{
+	COL_PATH,
+	COL_NAME,
+	COL_IS_DIR,
+	COL_IS_LINK,
+	COL_IS_PIXBUF,
+	COL_PIXBUF,
+	COL_SIZE,
+	COL_SURFACE,
+	NUM_COLS
+};
+
+#define GMF_TYPE_DIR_MODEL gmf_dir_model_get_type ()
+
+G_DECLARE_FINAL_TYPE ( GmfDirModel, gmf_dir_model, GMF, DIR_MODEL, GObject )
+
+GmfDirModel * gmf_dir_model_new ( const char * );
+
+const char * gmf_dir_model_get_dir ( GmfDirModel * );
+
+void gmf_dir_model_insert ( GmfDirModel *, int, const GmfDirEntry *, gboolean, GdkPixbuf * );
+void gmf_dir_model_remove ( GmfDirModel *, GtkTreeIter * );
+void gmf_dir_model_reorder ( GmfDirModel *, const int * );
+
+void gmf_dir_model_set_pixbuf ( GmfDirModel *, GtkTreeIter *, GdkPixbuf * );
+void gmf_dir_model_set_pixbuf_quiet ( GmfDirModel *, GtkTreeIter *, GdkPixbuf * );
+void gmf_dir_model_set_preview ( GmfDirModel *, GtkTreeIter *, GdkPixbuf * );
+void gmf_dir_model_reset_pixbufs ( GmfDirModel *, gboolean, GdkPixbuf *, GdkPixbuf * );
+
+void gmf_dir_model_set_scale ( GmfDirModel *, int );
+
+uint64_t gmf_dir_model_get_bytes ( GmfDirModel * );
+uint gmf_dir_model_evict ( GmfDirModel *, uint, uint, uint64_t, GdkPixbuf *, GdkPixbuf * );
+
+void gmf_dir_model_set_attempted ( GmfDirModel *, GtkTreeIter * );
+gboolean gmf_dir_model_is_due ( GmfDirModel *, GtkTreeIter * );
+
+gboolean gmf_dir_model_get_key ( GmfDirModel *, GtkTreeIter *, uint16_t, uint8_t, GmfPixbufKey * );
+gboolean gmf_dir_model_is_regular ( GmfDirModel *, GtkTreeIter * );
+
+const char * gmf_dir_model_get_name ( GmfDirModel *, GtkTreeIter * );
+gboolean gmf_dir_model_update ( GmfDirModel *, GtkTreeIter *, const GmfDirEntry *, gboolean, GdkPixbuf * );
+
+gboolean gmf_dir_model_find ( GmfDirModel *, const char *, GtkTreeIter * );
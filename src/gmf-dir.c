@@ -0,0 +1,306 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#include "gmf-dir.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define SORT_RUN 32
+#define SORT_PAR_MIN 32768
+#define SORT_PAR_MAX 16
+
+struct _GmfDir
+{
+	DIR *dir;
+	int dfd;
+
+	struct dirent *dent;
+};
+
+GmfDir * gmf_dir_open ( const char *path, GError **error )
+{
+	DIR *dir = opendir ( path );
+
+	if ( !dir )
+	{
+		int err = errno;
+		g_set_error ( error, G_FILE_ERROR, g_file_error_from_errno ( err ), "%s: %s", path, g_strerror ( err ) );
+
+		return NULL;
+	}
+
+	GmfDir *gdir = g_new0 ( GmfDir, 1 );
+
+	gdir->dir = dir;
+	gdir->dfd = dirfd ( dir );
+
+	return gdir;
+}
+
+void gmf_dir_close ( GmfDir *dir )
+{
+	closedir ( dir->dir );
+
+	free ( dir );
+}
+
+const char * gmf_dir_read_name ( GmfDir *dir )
+{
+	struct dirent *dent = NULL;
+
+	while ( ( dent = readdir ( dir->dir ) ) )
+	{
+		const char *name = dent->d_name;
+
+		if ( name[0] == '.' && ( name[1] == '\0' || ( name[1] == '.' && name[2] == '\0' ) ) ) continue;
+
+		break;
+	}
+
+	dir->dent = dent;
+
+	return ( dent ) ? dent->d_name : NULL;
+}
+
+// Which file it is and which version of it: what a cached thumbnail is keyed on
+static void gmf_dir_entry_set_id ( const struct stat *sb, GmfDirEntry *entry )
+{
+	entry->mtime  = (int64_t)sb->st_mtim.tv_sec;
+	entry->mtime_nsec = (uint32_t)sb->st_mtim.tv_nsec;
+	entry->dev    = (uint64_t)sb->st_dev;
+	entry->inode  = (uint64_t)sb->st_ino;
+}
+
+static void gmf_dir_entry_set_stat ( const struct stat *sb, GmfDirEntry *entry )
+{
+	gmf_dir_entry_set_id ( sb, entry );
+
+	entry->size   = (uint64_t)sb->st_size;
+	entry->is_dir = S_ISDIR ( sb->st_mode );
+	entry->is_regular = S_ISREG ( sb->st_mode );
+}
+
+static void gmf_dir_entry_stat_at ( int dfd, const char *name, unsigned char type, GmfDirEntry *entry )
+{
+	struct stat sb;
+
+	// d_type already tells a symlink apart, so one fstatat is enough: follow links, do not follow anything else
+	if ( type == DT_LNK ) entry->is_link = TRUE;
+
+	if ( fstatat ( dfd, name, &sb, ( type == DT_LNK ) ? 0 : AT_SYMLINK_NOFOLLOW ) != 0 )
+	{
+		// A dangling link: no size or type, but still a file of its own to the thumbnail cache
+		if ( type == DT_LNK && fstatat ( dfd, name, &sb, AT_SYMLINK_NOFOLLOW ) == 0 ) gmf_dir_entry_set_id ( &sb, entry );
+
+		return;
+	}
+
+	// DT_UNKNOWN ( some network and FUSE file systems ): a second call only for the symlinks
+	if ( S_ISLNK ( sb.st_mode ) )
+	{
+		struct stat lsb = sb;
+
+		entry->is_link = TRUE;
+
+		if ( fstatat ( dfd, name, &sb, 0 ) != 0 ) { gmf_dir_entry_set_id ( &lsb, entry ); return; }
+	}
+
+	gmf_dir_entry_set_stat ( &sb, entry );
+}
+
+GmfDirEntry * gmf_dir_read_entry ( GmfDir *dir )
+{
+	if ( !dir->dent ) return NULL;
+
+	unsigned char type = DT_UNKNOWN;
+
+#ifdef _DIRENT_HAVE_D_TYPE
+	type = dir->dent->d_type;
+#endif
+
+	GmfDirEntry *entry = g_new0 ( GmfDirEntry, 1 );
+
+	entry->name = g_strdup ( dir->dent->d_name );
+	entry->display_name = g_filename_display_name ( entry->name );
+
+	gmf_dir_entry_stat_at ( dir->dfd, entry->name, type, entry );
+
+	return entry;
+}
+
+GmfDirEntry * gmf_dir_entry_new_for_path ( const char *path )
+{
+	GmfDirEntry *entry = g_new0 ( GmfDirEntry, 1 );
+
+	entry->name = g_path_get_basename ( path );
+	entry->display_name = g_filename_display_name ( entry->name );
+
+	gmf_dir_entry_stat_at ( AT_FDCWD, path, DT_UNKNOWN, entry );
+
+	return entry;
+}
+
+void gmf_dir_entry_free ( GmfDirEntry *entry )
+{
+	free ( entry->name );
+	free ( entry->display_name );
+	free ( entry );
+}
+
+// ***** Sort *****
+
+void gmf_dir_sort_set ( uint32_t indx, const GmfDirEntry *entry, GmfDirSort *rec )
+{
+	rec->key  = g_utf8_collate_key_for_filename ( entry->display_name, -1 );
+	rec->size = entry->size;
+	rec->indx = indx;
+	rec->is_dir = entry->is_dir;
+}
+
+void gmf_dir_sort_clear ( GmfDirSort *rec )
+{
+	free ( rec->key );
+
+	rec->key = NULL;
+}
+
+int gmf_dir_sort_cmp ( const GmfDirSort *a, const GmfDirSort *b, enum sort_enm sort )
+{
+	if ( a->is_dir != b->is_dir ) return ( a->is_dir ) ? -1 : 1;
+
+	if ( sort == SORT_MG && a->size != b->size ) return ( a->size < b->size ) ? -1 : 1;
+	if ( sort == SORT_GM && a->size != b->size ) return ( a->size > b->size ) ? -1 : 1;
+
+	int ret = strcmp ( a->key, b->key );
+
+	return ( sort == SORT_ZA ) ? -ret : ret;
+}
+
+static void gmf_dir_sort_merge ( const GmfDirSort *a, uint32_t na, const GmfDirSort *b, uint32_t nb, GmfDirSort *out, enum sort_enm sort )
+{
+	uint32_t i = 0, j = 0, k = 0;
+
+	while ( i < na && j < nb ) out[k++] = ( gmf_dir_sort_cmp ( &b[j], &a[i], sort ) < 0 ) ? b[j++] : a[i++];
+
+	while ( i < na ) out[k++] = a[i++];
+	while ( j < nb ) out[k++] = b[j++];
+}
+
+static void gmf_dir_sort_run ( GmfDirSort *recs, GmfDirSort *tmp, uint32_t n, enum sort_enm sort )
+{
+	if ( n <= SORT_RUN )
+	{
+		uint32_t i = 0, j = 0; for ( i = 1; i < n; i++ )
+		{
+			GmfDirSort rec = recs[i];
+
+			for ( j = i; j > 0 && gmf_dir_sort_cmp ( &rec, &recs[j - 1], sort ) < 0; j-- ) recs[j] = recs[j - 1];
+
+			recs[j] = rec;
+		}
+
+		return;
+	}
+
+	uint32_t h = n / 2;
+
+	gmf_dir_sort_run ( recs,     tmp,     h,     sort );
+	gmf_dir_sort_run ( recs + h, tmp + h, n - h, sort );
+
+	if ( gmf_dir_sort_cmp ( &recs[h - 1], &recs[h], sort ) <= 0 ) return;
+
+	gmf_dir_sort_merge ( recs, h, recs + h, n - h, tmp, sort );
+
+	memcpy ( recs, tmp, n * sizeof ( GmfDirSort ) );
+}
+
+typedef struct _SortPart SortPart;
+
+struct _SortPart
+{
+	GmfDirSort *src;
+	GmfDirSort *dst;
+
+	uint32_t na;
+	uint32_t nb;
+
+	enum sort_enm sort;
+};
+
+static gpointer gmf_dir_sort_run_thread ( SortPart *part )
+{
+	gmf_dir_sort_run ( part->src, part->dst, part->na, part->sort );
+
+	return NULL;
+}
+
+static gpointer gmf_dir_sort_merge_thread ( SortPart *part )
+{
+	gmf_dir_sort_merge ( part->src, part->na, part->src + part->na, part->nb, part->dst, part->sort );
+
+	return NULL;
+}
+
+static void gmf_dir_sort_parts ( GThreadFunc func, SortPart *parts, uint8_t n_parts )
+{
+	GThread *threads[SORT_PAR_MAX];
+
+	uint8_t p = 0;
+	for ( p = 0; p < n_parts; p++ ) threads[p] = g_thread_new ( "dir-sort", func, &parts[p] );
+	for ( p = 0; p < n_parts; p++ ) g_thread_join ( threads[p] );
+}
+
+/* Stable merge sort of the packed records; above SORT_PAR_MIN records the runs
+ * are sorted on one thread per core and merged pairwise, also in parallel. */
+void gmf_dir_sort ( GmfDirSort *recs, uint32_t n, enum sort_enm sort )
+{
+	uint8_t n_runs = 1;
+	uint procs = (uint)g_get_num_processors ();
+
+	if ( n >= SORT_PAR_MIN ) while ( n_runs * 2 <= MIN ( procs, SORT_PAR_MAX ) ) n_runs *= 2;
+
+	GmfDirSort *tmp = g_new ( GmfDirSort, n );
+
+	if ( n_runs == 1 ) { gmf_dir_sort_run ( recs, tmp, n, sort ); free ( tmp ); return; }
+
+	SortPart parts[SORT_PAR_MAX];
+	uint32_t start[SORT_PAR_MAX + 1];
+
+	uint8_t r = 0;
+	for ( r = 0; r <= n_runs; r++ ) start[r] = (uint32_t)( (uint64_t)n * r / n_runs );
+
+	for ( r = 0; r < n_runs; r++ ) parts[r] = (SortPart){ recs + start[r], tmp + start[r], start[r + 1] - start[r], 0, sort };
+
+	gmf_dir_sort_parts ( (GThreadFunc)gmf_dir_sort_run_thread, parts, n_runs );
+
+	GmfDirSort *src = recs, *dst = tmp;
+
+	uint8_t width = 1; for ( width = 1; width < n_runs; width *= 2 )
+	{
+		uint8_t n_parts = 0;
+
+		for ( r = 0; r < n_runs; r += 2 * width )
+		{
+			uint32_t a = start[r], b = start[r + width], c = start[MIN ( r + 2 * width, n_runs )];
+
+			parts[n_parts++] = (SortPart){ src + a, dst + a, b - a, c - b, sort };
+		}
+
+		gmf_dir_sort_parts ( (GThreadFunc)gmf_dir_sort_merge_thread, parts, n_parts );
+
+		GmfDirSort *swap = src; src = dst; dst = swap;
+	}
+
+	if ( src != recs ) memcpy ( recs, src, n * sizeof ( GmfDirSort ) );
+
+	free ( tmp );
+}
@@ -0,0 +1,66 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#pragma once
+
+#include <gtk/gtk.h>
+
+enum sort_enm 
+{
+	SORT_AZ,
+	SORT_ZA,
+	SORT_MG,
+	SORT_GM
+};
+
+typedef struct _GmfDir GmfDir;
+
+typedef struct _GmfDirEntry GmfDirEntry;
+
+struct _GmfDirEntry
+{
+	char *name;
+	char *display_name;
+
+	uint64_t size;
+	int64_t mtime;
+	uint32_t mtime_nsec;
+
+	// Zero when the file could not be stat'ed at all; a dangling link has the link's own
+	uint64_t dev;
+	uint64_t inode;
+
+	gboolean is_dir;
+	gboolean is_link;
+	gboolean is_regular;
+};
+
+typedef struct _GmfDirSort GmfDirSort;
+
+struct _GmfDirSort
+{
+	char *key;
+	uint64_t size;
+
+	uint32_t indx;
+	gboolean is_dir;
+};
+
+GmfDir * gmf_dir_open ( const char *, GError ** );
+const char * gmf_dir_read_name ( GmfDir * );
+GmfDirEntry * gmf_dir_read_entry ( GmfDir * );
+void gmf_dir_close ( GmfDir * );
+
+GmfDirEntry * gmf_dir_entry_new_for_path ( const char * );
+void gmf_dir_entry_free ( GmfDirEntry * );
+
+void gmf_dir_sort_set ( uint32_t, const GmfDirEntry *, GmfDirSort * );
+void gmf_dir_sort_clear ( GmfDirSort * );
+int gmf_dir_sort_cmp ( const GmfDirSort *, const GmfDirSort *, enum sort_enm );
+void gmf_dir_sort ( GmfDirSort *, uint32_t, enum sort_enm );
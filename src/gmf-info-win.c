@@ -9,6 +9,7 @@
 
 #include "gmf-dialog.h"
 #include "gmf-info-win.h"
+#include "gmf-mime.h"
 
 #include <errno.h>
 #include <sys/stat.h>
@@ -508,7 +509,8 @@ static void info_win_create ( enum info_sel_enm num, const char *odir, const cha
 	gboolean is_link = g_file_test ( win->path, G_FILE_TEST_IS_SYMLINK );
 
 	GFile *file = g_file_new_for_path ( win->path );
-	GFileInfo *finfo = g_file_query_info ( file, "*", 0, NULL, NULL );
+	GFileInfo *finfo = gmf_mime_query_info ( file, G_FILE_ATTRIBUTE_OWNER_USER "," G_FILE_ATTRIBUTE_OWNER_GROUP ","
+		G_FILE_ATTRIBUTE_TIME_ACCESS "," G_FILE_ATTRIBUTE_TIME_MODIFIED "," G_FILE_ATTRIBUTE_STANDARD_SYMLINK_TARGET );
 
 	g_autofree char *owner = g_file_info_get_attribute_as_string ( finfo, G_FILE_ATTRIBUTE_OWNER_USER  );
 	g_autofree char *group = g_file_info_get_attribute_as_string ( finfo, G_FILE_ATTRIBUTE_OWNER_GROUP );
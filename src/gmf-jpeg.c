@@ -0,0 +1,285 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#include "gmf-jpeg.h"
+#include "gmf-scale.h"
+
+#include <stdio.h>
+#include <setjmp.h>
+#include <jpeglib.h>
+
+#define JPEG_MARKERS 16
+
+// A progressive JPEG keeps every coefficient of the whole image while it decodes
+#define JPEG_MAX_PROGRESSIVE ( 50 * 1000 * 1000 )
+
+typedef struct _JpegExif JpegExif;
+
+struct _JpegExif
+{
+	int orientation;
+
+	const uint8_t *data;
+	uint size;
+
+	// The embedded thumbnail, inside data
+	const uint8_t *thumb;
+	uint thumb_size;
+};
+
+typedef struct _JpegError JpegError;
+
+struct _JpegError
+{
+	struct jpeg_error_mgr mgr;
+	jmp_buf jump;
+};
+
+static uint gmf_jpeg_get_16 ( const uint8_t *p, gboolean le )
+{
+	return ( le ) ? (uint)( p[0] | p[1] << 8 ) : (uint)( p[0] << 8 | p[1] );
+}
+
+static uint gmf_jpeg_get_32 ( const uint8_t *p, gboolean le )
+{
+	return ( le ) ? ( (uint)p[0] | (uint)p[1] << 8 | (uint)p[2] << 16 | (uint)p[3] << 24 )
+	              : ( (uint)p[0] << 24 | (uint)p[1] << 16 | (uint)p[2] << 8 | (uint)p[3] );
+}
+
+// TIFF structure of the APP1 segment: IFD0 holds the orientation, IFD1 the thumbnail
+static void gmf_jpeg_exif_parse ( JpegExif *exif )
+{
+	const uint8_t *tiff = exif->data + 6;
+	uint size = exif->size - 6;
+
+	if ( size < 8 || !( tiff[0] == tiff[1] && ( tiff[0] == 'I' || tiff[0] == 'M' ) ) ) return;
+
+	gboolean le = ( tiff[0] == 'I' );
+
+	if ( gmf_jpeg_get_16 ( tiff + 2, le ) != 42 ) return;
+
+	uint ifd = gmf_jpeg_get_32 ( tiff + 4, le ), thumb_offset = 0, thumb_size = 0;
+
+	uint n = 0; for ( n = 0; n < 2 && ifd && ifd <= size - 2; n++ )
+	{
+		uint count = gmf_jpeg_get_16 ( tiff + ifd, le );
+
+		if ( ( size - ifd - 2 ) / 12 < count ) return;
+
+		uint i = 0; for ( i = 0; i < count; i++ )
+		{
+			const uint8_t *entry = tiff + ifd + 2 + i * 12;
+
+			uint tag = gmf_jpeg_get_16 ( entry, le );
+
+			if ( n == 0 && tag == 0x0112 ) exif->orientation = (int)gmf_jpeg_get_16 ( entry + 8, le );
+
+			if ( n == 1 && tag == 0x0201 ) thumb_offset = gmf_jpeg_get_32 ( entry + 8, le );
+			if ( n == 1 && tag == 0x0202 ) thumb_size   = gmf_jpeg_get_32 ( entry + 8, le );
+		}
+
+		uint next = ifd + 2 + count * 12;
+
+		ifd = ( next <= size - 4 ) ? gmf_jpeg_get_32 ( tiff + next, le ) : 0;
+	}
+
+	if ( thumb_offset && thumb_size && thumb_offset < size && thumb_size <= size - thumb_offset )
+	{
+		exif->thumb = tiff + thumb_offset;
+		exif->thumb_size = thumb_size;
+	}
+}
+
+// The start of image marker: all it takes to tell a JPEG from the first bytes
+gboolean gmf_jpeg_is_jpeg ( const uint8_t *data, size_t size )
+{
+	return ( size >= 2 && data[0] == 0xFF && data[1] == 0xD8 );
+}
+
+// Walks the markers before the image data; FALSE when the buffer is not a JPEG
+static gboolean gmf_jpeg_exif_find ( const uint8_t *data, size_t size, JpegExif *exif )
+{
+	if ( !gmf_jpeg_is_jpeg ( data, size ) ) return FALSE;
+
+	size_t pos = 2;
+
+	uint n = 0; for ( n = 0; n < JPEG_MARKERS && pos + 4 <= size && data[pos] == 0xFF; n++ )
+	{
+		uint marker = data[pos + 1], len = gmf_jpeg_get_16 ( data + pos + 2, FALSE );
+
+		// Start of frame or scan: the header is over
+		if ( marker == 0xDA || ( marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC ) ) break;
+
+		if ( len < 2 || len > size - pos - 2 ) break;
+
+		if ( marker == 0xE1 && !exif->data && len - 2 > 6 && memcmp ( data + pos + 4, "Exif\0\0", 6 ) == 0 )
+		{
+			exif->data = data + pos + 4;
+			exif->size = len - 2;
+
+			gmf_jpeg_exif_parse ( exif );
+		}
+
+		pos += 2 + len;
+	}
+
+	return TRUE;
+}
+
+static void gmf_jpeg_error_exit ( j_common_ptr cinfo )
+{
+	JpegError *err = (JpegError *)cinfo->err;
+
+	longjmp ( err->jump, 1 );
+}
+
+static void gmf_jpeg_output_message ( G_GNUC_UNUSED j_common_ptr cinfo ) {}
+
+/* Decode with the largest DCT scaling (1/8, 1/4, 1/2) that keeps the longer side at least size.
+ * min > 0 rejects an image whose longer side is below it, before anything is decoded. */
+static GdkPixbuf * gmf_jpeg_decode ( const uint8_t *data, size_t data_size, int size, int min )
+{
+	struct jpeg_decompress_struct cinfo;
+	JpegError err;
+
+	GdkPixbuf * volatile pixbuf = NULL;
+
+	cinfo.err = jpeg_std_error ( &err.mgr );
+	err.mgr.error_exit = gmf_jpeg_error_exit;
+	err.mgr.output_message = gmf_jpeg_output_message;
+
+	if ( setjmp ( err.jump ) )
+	{
+		if ( pixbuf ) g_object_unref ( pixbuf );
+
+		jpeg_destroy_decompress ( &cinfo );
+
+		return NULL;
+	}
+
+	jpeg_create_decompress ( &cinfo );
+
+	jpeg_mem_src ( &cinfo, (unsigned char *)data, (ulong)data_size );
+
+	jpeg_read_header ( &cinfo, TRUE );
+
+	uint max = MAX ( cinfo.image_width, cinfo.image_height );
+
+	if ( cinfo.progressive_mode && (uint64_t)cinfo.image_width * cinfo.image_height > JPEG_MAX_PROGRESSIVE ) { jpeg_destroy_decompress ( &cinfo ); return NULL; }
+
+	// CMYK needs an inversion libjpeg does not do: left to gdk-pixbuf
+	if ( max < (uint)min || cinfo.jpeg_color_space == JCS_CMYK || cinfo.jpeg_color_space == JCS_YCCK ) { jpeg_destroy_decompress ( &cinfo ); return NULL; }
+
+	uint denom = 8;
+	while ( denom > 1 && ( max + denom - 1 ) / denom < (uint)size ) denom /= 2;
+
+	cinfo.scale_num   = 1;
+	cinfo.scale_denom = denom;
+	cinfo.out_color_space = JCS_RGB;
+	cinfo.dct_method = JDCT_IFAST;
+	cinfo.do_fancy_upsampling = FALSE;
+
+	jpeg_start_decompress ( &cinfo );
+
+	pixbuf = gdk_pixbuf_new ( GDK_COLORSPACE_RGB, FALSE, 8, (int)cinfo.output_width, (int)cinfo.output_height );
+
+	if ( !pixbuf ) { jpeg_destroy_decompress ( &cinfo ); return NULL; }
+
+	uint8_t *pixels = gdk_pixbuf_get_pixels ( pixbuf );
+	int stride = gdk_pixbuf_get_rowstride ( pixbuf );
+
+	while ( cinfo.output_scanline < cinfo.output_height )
+	{
+		JSAMPROW row = pixels + (size_t)cinfo.output_scanline * (size_t)stride;
+
+		jpeg_read_scanlines ( &cinfo, &row, 1 );
+	}
+
+	jpeg_finish_decompress ( &cinfo );
+	jpeg_destroy_decompress ( &cinfo );
+
+	return pixbuf;
+}
+
+// Same fit as gdk_pixbuf_new_from_file_at_size: the longer side becomes size
+static GdkPixbuf * gmf_jpeg_fit ( GdkPixbuf *pixbuf, int size )
+{
+	int w = gdk_pixbuf_get_width  ( pixbuf );
+	int h = gdk_pixbuf_get_height ( pixbuf );
+
+	if ( MAX ( w, h ) == size ) return pixbuf;
+
+	double k = (double)size / MAX ( w, h );
+
+	GdkPixbuf *scaled = gmf_scale_down ( pixbuf, MAX ( 1, (int)( w * k + 0.5 ) ), MAX ( 1, (int)( h * k + 0.5 ) ) );
+
+	g_object_unref ( pixbuf );
+
+	return scaled;
+}
+
+// EXIF orientation 2..8, the same transforms as gdk_pixbuf_apply_embedded_orientation
+static GdkPixbuf * gmf_jpeg_orient ( GdkPixbuf *pixbuf, int orientation )
+{
+	GdkPixbuf *temp = NULL, *dest = NULL;
+
+	switch ( orientation )
+	{
+		case 2: dest = gdk_pixbuf_flip ( pixbuf, TRUE  ); break;
+		case 3: dest = gdk_pixbuf_rotate_simple ( pixbuf, GDK_PIXBUF_ROTATE_UPSIDEDOWN ); break;
+		case 4: dest = gdk_pixbuf_flip ( pixbuf, FALSE ); break;
+		case 5: temp = gdk_pixbuf_rotate_simple ( pixbuf, GDK_PIXBUF_ROTATE_CLOCKWISE ); dest = gdk_pixbuf_flip ( temp, TRUE ); break;
+		case 6: dest = gdk_pixbuf_rotate_simple ( pixbuf, GDK_PIXBUF_ROTATE_CLOCKWISE ); break;
+		case 7: temp = gdk_pixbuf_rotate_simple ( pixbuf, GDK_PIXBUF_ROTATE_COUNTERCLOCKWISE ); dest = gdk_pixbuf_flip ( temp, TRUE ); break;
+		case 8: dest = gdk_pixbuf_rotate_simple ( pixbuf, GDK_PIXBUF_ROTATE_COUNTERCLOCKWISE ); break;
+
+		default: return pixbuf;
+	}
+
+	if ( temp ) g_object_unref ( temp );
+
+	if ( !dest ) return pixbuf;
+
+	g_object_unref ( pixbuf );
+
+	return dest;
+}
+
+/* A JPEG in memory, scaled so its longer side is size and turned upright: from the EXIF thumbnail
+ * when that is big enough, otherwise decoded in the DCT domain near the target. NULL for anything else. */
+GdkPixbuf * gmf_jpeg_load ( const uint8_t *data, size_t data_size, int size )
+{
+	JpegExif exif = { 1, NULL, 0, NULL, 0 };
+
+	if ( !gmf_jpeg_exif_find ( data, data_size, &exif ) ) return NULL;
+
+	GdkPixbuf *pixbuf = ( exif.thumb ) ? gmf_jpeg_decode ( exif.thumb, exif.thumb_size, size, size ) : NULL;
+
+	if ( !pixbuf ) pixbuf = gmf_jpeg_decode ( data, data_size, size, 0 );
+
+	if ( !pixbuf ) return NULL;
+
+	pixbuf = gmf_jpeg_fit ( pixbuf, size );
+
+	return ( pixbuf ) ? gmf_jpeg_orient ( pixbuf, exif.orientation ) : NULL;
+}
+
+/* Only the EXIF thumbnail, turned upright, at the size it was stored: the headers are enough, so data
+ * may be the first bytes of the file. NULL when they hold none, or are not a JPEG. */
+GdkPixbuf * gmf_jpeg_load_exif ( const uint8_t *data, size_t data_size )
+{
+	JpegExif exif = { 1, NULL, 0, NULL, 0 };
+
+	if ( !gmf_jpeg_exif_find ( data, data_size, &exif ) || !exif.thumb ) return NULL;
+
+	// No DCT scaling: the thumbnail is small already
+	GdkPixbuf *pixbuf = gmf_jpeg_decode ( exif.thumb, exif.thumb_size, G_MAXINT, 0 );
+
+	return ( pixbuf ) ? gmf_jpeg_orient ( pixbuf, exif.orientation ) : NULL;
+}
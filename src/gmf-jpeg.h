@@ -0,0 +1,17 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#pragma once
+
+#include <gtk/gtk.h>
+
+gboolean gmf_jpeg_is_jpeg ( const uint8_t *, size_t );
+
+GdkPixbuf * gmf_jpeg_load ( const uint8_t *, size_t, int );
+GdkPixbuf * gmf_jpeg_load_exif ( const uint8_t *, size_t );
@@ -0,0 +1,170 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#include "gmf-mime.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+
+#define MIME_SNIFF 4096 // bytes GIO reads of a file its name leaves uncertain, for the magic rules
+#define MIME_MAX   1024 // keys before the cache starts over; each holds up to MIME_SNIFF bytes
+
+typedef struct _MimeKey MimeKey;
+
+/* Files alike in these are taken to be of one type: the sniffing is done once for all of them.
+ * The name goes in as GIO reads it, through the globs: full names and double suffixes included;
+ * the bytes are all GIO looks at, so nothing it would tell apart shares a key. */
+struct _MimeKey
+{
+	const char *name_type;
+	uint hash;
+
+	uint16_t n_data;
+	uint8_t *data;
+};
+
+G_LOCK_DEFINE_STATIC ( mime_cache );
+
+// MimeKey -> interned content type
+static GHashTable *mime_cache = NULL;
+
+static uint gmf_mime_key_hash ( const MimeKey *key )
+{
+	return key->hash;
+}
+
+static gboolean gmf_mime_key_equal ( const MimeKey *a, const MimeKey *b )
+{
+	return a->hash == b->hash && a->name_type == b->name_type && a->n_data == b->n_data && memcmp ( a->data, b->data, a->n_data ) == 0;
+}
+
+static void gmf_mime_key_free ( MimeKey *key )
+{
+	free ( key->data );
+	free ( key );
+}
+
+static const char * gmf_mime_guess ( const char *base, const uint8_t *data, size_t size, uint64_t file_size )
+{
+	gboolean uncertain = FALSE;
+
+	g_autofree char *type = g_content_type_guess ( base, data, size, &uncertain );
+
+	// As GIO has it for an empty file it cannot name
+	if ( uncertain && file_size == 0 ) return g_intern_static_string ( "application/x-zerosize" );
+
+	return g_intern_string ( type );
+}
+
+/* Content type of the regular file path, as GIO would sniff it. A name that settles the type is the
+ * answer, the file is not read, as GIO does; otherwise the first bytes are, and matched against the
+ * magic rules once per (name-only type, bytes). */
+const char * gmf_mime_get_content_type ( const char *path )
+{
+	uint8_t data[MIME_SNIFF];
+
+	g_autofree char *base = g_path_get_basename ( path );
+
+	gboolean uncertain = FALSE;
+
+	g_autofree char *name_type = g_content_type_guess ( base, NULL, 0, &uncertain );
+
+	if ( !uncertain ) return g_intern_string ( name_type );
+
+	// Not blocking on a FIFO should one get here: callers only pass what they know to be regular
+	int fd = g_open ( path, O_RDONLY | O_CLOEXEC | O_NONBLOCK | O_NOCTTY, 0 );
+
+	GStatBuf st;
+
+	if ( fd == -1 || fstat ( fd, &st ) != 0 || !S_ISREG ( st.st_mode ) )
+	{
+		if ( fd != -1 ) close ( fd );
+
+		// Unreadable: the name is all there is
+		return gmf_mime_guess ( base, NULL, 0, 1 );
+	}
+
+	ssize_t n = read ( fd, data, sizeof ( data ) );
+
+	close ( fd );
+
+	size_t size = ( n > 0 ) ? (size_t)n : 0;
+
+	// Empty: the type does not depend on any bytes
+	if ( !size ) return gmf_mime_guess ( base, NULL, 0, (uint64_t)st.st_size );
+
+	MimeKey key;
+
+	key.name_type = g_intern_string ( name_type );
+	key.n_data = (uint16_t)size;
+	key.data = data;
+	key.hash = g_direct_hash ( key.name_type );
+
+	size_t i = 0; for ( i = 0; i < size; i++ ) key.hash = key.hash * 31 + data[i];
+
+	G_LOCK ( mime_cache );
+
+	const char *type = ( mime_cache ) ? g_hash_table_lookup ( mime_cache, &key ) : NULL;
+
+	G_UNLOCK ( mime_cache );
+
+	if ( type ) return type;
+
+	type = gmf_mime_guess ( base, data, size, (uint64_t)st.st_size );
+
+	G_LOCK ( mime_cache );
+
+	if ( !mime_cache ) mime_cache = g_hash_table_new_full ( (GHashFunc)gmf_mime_key_hash, (GEqualFunc)gmf_mime_key_equal, (GDestroyNotify)gmf_mime_key_free, NULL );
+
+	if ( g_hash_table_size ( mime_cache ) >= MIME_MAX ) g_hash_table_remove_all ( mime_cache );
+
+	MimeKey *copy = g_new ( MimeKey, 1 );
+	*copy = key;
+	copy->data = g_malloc ( size );
+
+	memcpy ( copy->data, data, size );
+
+	g_hash_table_replace ( mime_cache, copy, (gpointer)type );
+
+	G_UNLOCK ( mime_cache );
+
+	return type;
+}
+
+/* g_file_query_info for just the attributes asked for, plus the content type and icon of the file.
+ * Regular local files (links followed, as GIO does) get them from the cache above; folders keep GIO's
+ * own icons (home, desktop...), and special and remote files are left to GIO as well. */
+GFileInfo * gmf_mime_query_info ( GFile *file, const char *attributes )
+{
+	g_autofree char *path = g_file_get_path ( file );
+
+	GStatBuf st;
+
+	gboolean regular = ( path && g_stat ( path, &st ) == 0 && S_ISREG ( st.st_mode ) );
+
+	g_autofree char *query = ( regular ) ? g_strdup ( attributes )
+		: g_strconcat ( attributes, ",", G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE, ",", G_FILE_ATTRIBUTE_STANDARD_ICON, NULL );
+
+	GFileInfo *finfo = g_file_query_info ( file, query, 0, NULL, NULL );
+
+	if ( !finfo || !regular ) return finfo;
+
+	const char *content_type = gmf_mime_get_content_type ( path );
+
+	GIcon *icon = g_content_type_get_icon ( content_type );
+
+	g_file_info_set_content_type ( finfo, content_type );
+	g_file_info_set_icon ( finfo, icon );
+
+	g_object_unref ( icon );
+
+	return finfo;
+}
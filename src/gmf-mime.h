@@ -0,0 +1,16 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#pragma once
+
+#include <gtk/gtk.h>
+
+const char * gmf_mime_get_content_type ( const char * );
+
+GFileInfo * gmf_mime_query_info ( GFile *, const char * );
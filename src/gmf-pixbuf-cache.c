@@ -0,0 +1,259 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#include "gmf-pixbuf-cache.h"
+
+#include <sys/stat.h>
+
+#define PIXBUF_BUDGET 64
+
+// Icon size and scale of the entry that holds the largest thumbnail decoded for a file
+#define PIXBUF_TIER 0
+
+typedef struct _PixbufNode PixbufNode;
+
+struct _PixbufNode
+{
+	GmfPixbufKey key;
+
+	GdkPixbuf *pixbuf;
+	size_t bytes;
+
+	// The size in device pixels the pixbuf was made for: the key's, or the decoded one of a tier entry
+	uint made_for;
+};
+
+G_LOCK_DEFINE_STATIC ( pixbuf_cache );
+
+// Shared by every window and thread of the process; the head of the queue is the most recent
+static GQueue cache_lru = G_QUEUE_INIT;
+static GHashTable *cache_table = NULL;
+
+static size_t cache_bytes = 0;
+static size_t cache_budget = (size_t)PIXBUF_BUDGET << 20;
+
+gboolean gmf_pixbuf_key_init ( const char *path, gboolean is_link, uint16_t icon_size, uint8_t scale, GmfPixbufKey *key )
+{
+	struct stat st;
+
+	// A broken link still gets a key of its own
+	if ( stat ( path, &st ) != 0 && lstat ( path, &st ) != 0 ) return FALSE;
+
+	memset ( key, 0, sizeof ( GmfPixbufKey ) );
+
+	key->dev   = (uint64_t)st.st_dev;
+	key->inode = (uint64_t)st.st_ino;
+	key->size  = (uint64_t)st.st_size;
+	key->mtime = (int64_t)st.st_mtim.tv_sec * G_USEC_PER_SEC * 1000 + st.st_mtim.tv_nsec;
+
+	key->icon_size = icon_size;
+	key->scale = scale;
+	key->is_link = is_link;
+
+	return TRUE;
+}
+
+// The same key from a listing's entry, without stat'ing the file again; icon_size, scale and is_link are set either way
+gboolean gmf_pixbuf_key_init_entry ( const GmfDirEntry *entry, uint16_t icon_size, uint8_t scale, GmfPixbufKey *key )
+{
+	memset ( key, 0, sizeof ( GmfPixbufKey ) );
+
+	key->icon_size = icon_size;
+	key->scale = scale;
+	key->is_link = entry->is_link;
+
+	if ( !entry->inode ) return FALSE;
+
+	key->dev   = entry->dev;
+	key->inode = entry->inode;
+	key->size  = entry->size;
+	key->mtime = entry->mtime * G_USEC_PER_SEC * 1000 + entry->mtime_nsec;
+
+	return TRUE;
+}
+
+static GQuark pixbuf_shared_quark ( void )
+{
+	return g_quark_from_static_string ( "gmf-pixbuf-shared" );
+}
+
+// Theme and launcher icons: one pixbuf drawn for any number of files, its memory is not theirs
+void gmf_pixbuf_mark_shared ( GdkPixbuf *pixbuf )
+{
+	g_object_set_qdata ( G_OBJECT ( pixbuf ), pixbuf_shared_quark (), GINT_TO_POINTER ( TRUE ) );
+}
+
+gboolean gmf_pixbuf_is_shared ( GdkPixbuf *pixbuf )
+{
+	return GPOINTER_TO_INT ( g_object_get_qdata ( G_OBJECT ( pixbuf ), pixbuf_shared_quark () ) );
+}
+
+static uint pixbuf_key_hash ( const GmfPixbufKey *key )
+{
+	uint64_t h = key->inode * 0x9E3779B97F4A7C15ULL;
+
+	h ^= key->dev + ( h << 6 ) + ( h >> 2 );
+	h ^= key->size + ( h << 6 ) + ( h >> 2 );
+	h ^= (uint64_t)key->mtime + ( h << 6 ) + ( h >> 2 );
+	h ^= ( (uint64_t)key->scale << 17 | (uint64_t)key->icon_size << 1 | ( key->is_link ? 1 : 0 ) ) + ( h << 6 ) + ( h >> 2 );
+
+	return (uint)( h ^ ( h >> 32 ) );
+}
+
+static gboolean pixbuf_key_equal ( const GmfPixbufKey *a, const GmfPixbufKey *b )
+{
+	return a->inode == b->inode && a->dev == b->dev && a->size == b->size && a->mtime == b->mtime
+		&& a->icon_size == b->icon_size && a->scale == b->scale && !a->is_link == !b->is_link;
+}
+
+static void pixbuf_cache_remove ( GList *link )
+{
+	PixbufNode *node = (PixbufNode *)link->data;
+
+	g_hash_table_remove ( cache_table, &node->key );
+	g_queue_delete_link ( &cache_lru, link );
+
+	cache_bytes -= node->bytes;
+
+	g_object_unref ( node->pixbuf );
+	free ( node );
+}
+
+static void pixbuf_cache_trim ( void )
+{
+	while ( cache_lru.length && cache_bytes > cache_budget ) pixbuf_cache_remove ( g_queue_peek_tail_link ( &cache_lru ) );
+}
+
+// Lock held
+static void pixbuf_cache_add ( const GmfPixbufKey *key, GdkPixbuf *pixbuf, size_t bytes, uint made_for )
+{
+	PixbufNode *node = g_new0 ( PixbufNode, 1 );
+
+	node->key = *key;
+	node->pixbuf = g_object_ref ( pixbuf );
+	node->bytes = bytes;
+	node->made_for = made_for;
+
+	g_queue_push_head ( &cache_lru, node );
+	g_hash_table_insert ( cache_table, &node->key, g_queue_peek_head_link ( &cache_lru ) );
+
+	cache_bytes += bytes;
+
+	pixbuf_cache_trim ();
+}
+
+GdkPixbuf * gmf_pixbuf_cache_lookup ( const GmfPixbufKey *key )
+{
+	GdkPixbuf *pixbuf = NULL;
+
+	G_LOCK ( pixbuf_cache );
+
+	GList *link = ( cache_table ) ? g_hash_table_lookup ( cache_table, key ) : NULL;
+
+	if ( link )
+	{
+		g_queue_unlink ( &cache_lru, link );
+		g_queue_push_head_link ( &cache_lru, link );
+
+		pixbuf = g_object_ref ( ( (PixbufNode *)link->data )->pixbuf );
+	}
+
+	G_UNLOCK ( pixbuf_cache );
+
+	return pixbuf;
+}
+
+// A shared icon is charged its entry only: a folder of documents must not push the thumbnails out
+void gmf_pixbuf_cache_insert ( const GmfPixbufKey *key, GdkPixbuf *pixbuf )
+{
+	size_t bytes = ( ( gmf_pixbuf_is_shared ( pixbuf ) ) ? 0 : gdk_pixbuf_get_byte_length ( pixbuf ) ) + sizeof ( PixbufNode );
+
+	G_LOCK ( pixbuf_cache );
+
+	if ( !cache_table ) cache_table = g_hash_table_new ( (GHashFunc)pixbuf_key_hash, (GEqualFunc)pixbuf_key_equal );
+
+	if ( bytes <= cache_budget && !g_hash_table_contains ( cache_table, key ) ) pixbuf_cache_add ( key, pixbuf, bytes, (uint)key->icon_size * key->scale );
+
+	G_UNLOCK ( pixbuf_cache );
+}
+
+/* Keeps pixbuf as the file's tier when it was made for more device pixels than the one kept so far,
+ * whatever the scale. It sits in the LRU like any entry; when it is also the sized entry, its bytes are counted twice. */
+void gmf_pixbuf_cache_insert_tier ( const GmfPixbufKey *key, GdkPixbuf *pixbuf )
+{
+	GmfPixbufKey tier = *key;
+	tier.icon_size = PIXBUF_TIER;
+	tier.scale = PIXBUF_TIER;
+
+	uint made_for = (uint)key->icon_size * key->scale;
+
+	size_t bytes = gdk_pixbuf_get_byte_length ( pixbuf ) + sizeof ( PixbufNode );
+
+	G_LOCK ( pixbuf_cache );
+
+	if ( !cache_table ) cache_table = g_hash_table_new ( (GHashFunc)pixbuf_key_hash, (GEqualFunc)pixbuf_key_equal );
+
+	GList *link = g_hash_table_lookup ( cache_table, &tier );
+
+	if ( !link || ( (PixbufNode *)link->data )->made_for < made_for )
+	{
+		if ( link ) pixbuf_cache_remove ( link );
+
+		if ( bytes <= cache_budget ) pixbuf_cache_add ( &tier, pixbuf, bytes, made_for );
+	}
+
+	G_UNLOCK ( pixbuf_cache );
+}
+
+// The file's tier when it was made for key's device pixels or more: scaling it down gives the thumbnail
+GdkPixbuf * gmf_pixbuf_cache_lookup_tier ( const GmfPixbufKey *key )
+{
+	GmfPixbufKey tier = *key;
+	tier.icon_size = PIXBUF_TIER;
+	tier.scale = PIXBUF_TIER;
+
+	GdkPixbuf *pixbuf = NULL;
+
+	G_LOCK ( pixbuf_cache );
+
+	GList *link = ( cache_table ) ? g_hash_table_lookup ( cache_table, &tier ) : NULL;
+
+	if ( link && ( (PixbufNode *)link->data )->made_for >= (uint)key->icon_size * key->scale )
+	{
+		g_queue_unlink ( &cache_lru, link );
+		g_queue_push_head_link ( &cache_lru, link );
+
+		pixbuf = g_object_ref ( ( (PixbufNode *)link->data )->pixbuf );
+	}
+
+	G_UNLOCK ( pixbuf_cache );
+
+	return pixbuf;
+}
+
+// Icons come from the theme: a theme change makes every entry stale
+void gmf_pixbuf_cache_clear ( void )
+{
+	G_LOCK ( pixbuf_cache );
+
+	while ( cache_lru.length ) pixbuf_cache_remove ( g_queue_peek_tail_link ( &cache_lru ) );
+
+	G_UNLOCK ( pixbuf_cache );
+}
+
+void gmf_pixbuf_cache_set_budget ( uint mb )
+{
+	G_LOCK ( pixbuf_cache );
+
+	cache_budget = (size_t)mb << 20;
+
+	pixbuf_cache_trim ();
+
+	G_UNLOCK ( pixbuf_cache );
+}
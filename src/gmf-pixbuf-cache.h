@@ -0,0 +1,42 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#pragma once
+
+#include "gmf-dir.h"
+
+typedef struct _GmfPixbufKey GmfPixbufKey;
+
+struct _GmfPixbufKey
+{
+	uint64_t dev;
+	uint64_t inode;
+	uint64_t size;
+	int64_t mtime;
+
+	// Logical size and the scale factor it is drawn at: the pixbuf is icon_size x scale pixels
+	uint16_t icon_size;
+	uint8_t scale;
+	gboolean is_link;
+};
+
+gboolean gmf_pixbuf_key_init ( const char *, gboolean, uint16_t, uint8_t, GmfPixbufKey * );
+gboolean gmf_pixbuf_key_init_entry ( const GmfDirEntry *, uint16_t, uint8_t, GmfPixbufKey * );
+
+void gmf_pixbuf_mark_shared ( GdkPixbuf * );
+gboolean gmf_pixbuf_is_shared ( GdkPixbuf * );
+
+GdkPixbuf * gmf_pixbuf_cache_lookup ( const GmfPixbufKey * );
+void gmf_pixbuf_cache_insert ( const GmfPixbufKey *, GdkPixbuf * );
+
+GdkPixbuf * gmf_pixbuf_cache_lookup_tier ( const GmfPixbufKey * );
+void gmf_pixbuf_cache_insert_tier ( const GmfPixbufKey *, GdkPixbuf * );
+
+void gmf_pixbuf_cache_clear ( void );
+void gmf_pixbuf_cache_set_budget ( uint );
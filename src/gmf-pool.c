@@ -0,0 +1,211 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#include "gmf-pool.h"
+
+#define POOL_MAX 64
+#define DEQUE_SIZE 64
+
+typedef struct _PoolTask PoolTask;
+
+struct _PoolTask
+{
+	GmfPoolFunc func;
+
+	uint indx;
+	gpointer data;
+};
+
+typedef struct _PoolDeque PoolDeque;
+
+// Ring buffer: the owner takes from the head, idle workers steal from the tail
+struct _PoolDeque
+{
+	GMutex mutex;
+
+	PoolTask *tasks;
+
+	uint head;
+	uint len;
+	uint size;
+};
+
+typedef struct _PoolWorker PoolWorker;
+
+struct _PoolWorker
+{
+	GmfPool *pool;
+	uint id;
+};
+
+struct _GmfPool
+{
+	uint n_threads;
+
+	int next;
+
+	int pending;
+
+	GMutex mutex;
+	GCond cond;
+
+	PoolDeque  *deques;
+	PoolWorker *workers;
+};
+
+static void pool_deque_push ( PoolDeque *deque, PoolTask *task )
+{
+	if ( deque->len == deque->size )
+	{
+		uint size = deque->size * 2;
+		PoolTask *tasks = g_new ( PoolTask, size );
+
+		uint i = 0; for ( i = 0; i < deque->len; i++ ) tasks[i] = deque->tasks[( deque->head + i ) % deque->size];
+
+		free ( deque->tasks );
+
+		deque->tasks = tasks;
+		deque->size  = size;
+		deque->head  = 0;
+	}
+
+	deque->tasks[( deque->head + deque->len ) % deque->size] = *task;
+	deque->len++;
+}
+
+static gboolean pool_deque_take ( PoolDeque *deque, gboolean steal, PoolTask *task )
+{
+	gboolean ret = FALSE;
+
+	g_mutex_lock ( &deque->mutex );
+
+	if ( deque->len )
+	{
+		if ( steal )
+			*task = deque->tasks[( deque->head + deque->len - 1 ) % deque->size];
+		else
+		{
+			*task = deque->tasks[deque->head];
+			deque->head = ( deque->head + 1 ) % deque->size;
+		}
+
+		deque->len--;
+		ret = TRUE;
+	}
+
+	g_mutex_unlock ( &deque->mutex );
+
+	return ret;
+}
+
+static gboolean pool_take ( GmfPool *pool, uint id, PoolTask *task )
+{
+	if ( pool_deque_take ( &pool->deques[id], FALSE, task ) ) return TRUE;
+
+	uint k = 1; for ( k = 1; k < pool->n_threads; k++ )
+	{
+		if ( pool_deque_take ( &pool->deques[( id + k ) % pool->n_threads], TRUE, task ) ) return TRUE;
+	}
+
+	return FALSE;
+}
+
+static gpointer pool_worker_thread ( PoolWorker *worker )
+{
+	GmfPool *pool = worker->pool;
+
+	while ( TRUE )
+	{
+		PoolTask task;
+
+		if ( pool_take ( pool, worker->id, &task ) )
+		{
+			g_atomic_int_add ( &pool->pending, -1 );
+
+			task.func ( task.indx, task.data );
+
+			continue;
+		}
+
+		g_mutex_lock ( &pool->mutex );
+
+		while ( g_atomic_int_get ( &pool->pending ) == 0 ) g_cond_wait ( &pool->cond, &pool->mutex );
+
+		g_mutex_unlock ( &pool->mutex );
+	}
+
+	return NULL;
+}
+
+static void pool_wake ( GmfPool *pool )
+{
+	g_mutex_lock ( &pool->mutex );
+
+	g_cond_signal ( &pool->cond );
+
+	g_mutex_unlock ( &pool->mutex );
+}
+
+static GmfPool * gmf_pool_new ( uint n_threads )
+{
+	GmfPool *pool = g_new0 ( GmfPool, 1 );
+
+	pool->n_threads = CLAMP ( n_threads, 1, POOL_MAX );
+
+	g_mutex_init ( &pool->mutex );
+	g_cond_init  ( &pool->cond  );
+
+	pool->deques  = g_new0 ( PoolDeque,  pool->n_threads );
+	pool->workers = g_new0 ( PoolWorker, pool->n_threads );
+
+	uint i = 0; for ( i = 0; i < pool->n_threads; i++ )
+	{
+		g_mutex_init ( &pool->deques[i].mutex );
+
+		pool->deques[i].size  = DEQUE_SIZE;
+		pool->deques[i].tasks = g_new ( PoolTask, DEQUE_SIZE );
+
+		pool->workers[i].pool = pool;
+		pool->workers[i].id   = i;
+
+		GThread *thread = g_thread_new ( "gmf-pool", (GThreadFunc)pool_worker_thread, &pool->workers[i] );
+		g_thread_unref ( thread );
+	}
+
+	return pool;
+}
+
+// One worker per CPU, kept for the whole process
+GmfPool * gmf_pool_get_default ( void )
+{
+	static GmfPool *pool = NULL;
+
+	if ( g_once_init_enter ( &pool ) ) g_once_init_leave ( &pool, gmf_pool_new ( (uint)g_get_num_processors () ) );
+
+	return pool;
+}
+
+uint gmf_pool_get_n_threads ( GmfPool *pool )
+{
+	return pool->n_threads;
+}
+
+void gmf_pool_push ( GmfPool *pool, GmfPoolFunc func, uint indx, gpointer data )
+{
+	PoolTask task = { func, indx, data };
+
+	PoolDeque *deque = &pool->deques[(uint)g_atomic_int_add ( &pool->next, 1 ) % pool->n_threads];
+
+	g_mutex_lock ( &deque->mutex );
+		pool_deque_push ( deque, &task );
+		g_atomic_int_add ( &pool->pending, 1 );
+	g_mutex_unlock ( &deque->mutex );
+
+	pool_wake ( pool );
+}
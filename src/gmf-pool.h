@@ -0,0 +1,22 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#pragma once
+
+#include <gtk/gtk.h>
+
+typedef void ( *GmfPoolFunc ) ( uint, gpointer );
+
+typedef struct _GmfPool GmfPool;
+
+GmfPool * gmf_pool_get_default ( void );
+
+uint gmf_pool_get_n_threads ( GmfPool * );
+
+void gmf_pool_push ( GmfPool *, GmfPoolFunc, uint, gpointer );
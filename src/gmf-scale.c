@@ -0,0 +1,548 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#include "gmf-scale.h"
+
+#if defined ( __SSE2__ )
+	#include <emmintrin.h>
+	#define SCALE_SSE2 1
+#endif
+
+#if defined ( __GNUC__ ) && ( defined ( __x86_64__ ) || defined ( __i386__ ) ) && defined ( SCALE_SSE2 )
+	#include <immintrin.h>
+	#define SCALE_AVX2 1
+	#define SCALE_TARGET_AVX2 __attribute__ (( target ( "avx2" ) ))
+#endif
+
+#if defined ( __ARM_NEON )
+	#include <arm_neon.h>
+	#define SCALE_NEON 1
+#endif
+
+// Weights of a box filter in fixed point: a pixel times a weight stays within int16 multiplies
+#define SCALE_BITS 14
+#define SCALE_ONE ( 1 << SCALE_BITS )
+
+// Columns summed over the rows of one output row keep 7 fraction bits, so they still fit an int16
+#define SCALE_MID 7
+
+// Box filter taps of one axis: output i averages n[i] source pixels from start[i], weighted by coverage
+typedef struct _ScaleTaps ScaleTaps;
+
+struct _ScaleTaps
+{
+	int *start;
+	int *n;
+
+	int16_t *w;
+	int max_n;
+};
+
+/* One output row is made in three steps: every source row under it is added to acc with its weight,
+ * acc is narrowed to 16 bits, and the narrowed row is averaged along x. The first step touches
+ * every source byte once and is where the time goes; the other two run once per output row. */
+typedef struct _ScaleKernels ScaleKernels;
+
+struct _ScaleKernels
+{
+	const char *name;
+
+	void ( *v ) ( const uint8_t *, int16_t, int, uint32_t * );
+	void ( *narrow ) ( const uint32_t *, int, uint16_t * );
+	void ( *h ) ( const uint16_t *, int, const ScaleTaps *, int, uint8_t * );
+
+	// RGBA in place: the colour times alpha, so transparent pixels do not bleed into the average
+	void ( *premul ) ( uint8_t *, int );
+};
+
+static void gmf_scale_taps_init ( ScaleTaps *taps, int src, int dst )
+{
+	double s = (double)src / dst;
+
+	taps->max_n = (int)s + 2;
+	taps->start = g_new0 ( int, dst );
+	taps->n = g_new0 ( int, dst );
+	taps->w = g_new0 ( int16_t, (size_t)dst * (size_t)taps->max_n );
+
+	int x = 0; for ( x = 0; x < dst; x++ )
+	{
+		double x0 = x * s, x1 = MIN ( (double)src, ( x + 1 ) * s );
+
+		int i0 = (int)x0, i1 = (int)x1;
+
+		if ( i1 < x1 ) i1++;
+
+		int16_t *w = taps->w + (size_t)x * (size_t)taps->max_n;
+		int i = 0, n = 0, sum = 0, big = 0;
+
+		for ( i = i0; i < i1 && n < taps->max_n; i++, n++ )
+		{
+			double cover = MIN ( (double)( i + 1 ), x1 ) - MAX ( (double)i, x0 );
+
+			w[n] = (int16_t)( cover / s * SCALE_ONE + 0.5 );
+			sum += w[n];
+
+			if ( w[n] > w[big] ) big = n;
+		}
+
+		// Rounding must not change the brightness: the weights add up to exactly one
+		w[big] = (int16_t)( w[big] + SCALE_ONE - sum );
+
+		taps->start[x] = i0;
+		taps->n[x] = n;
+	}
+}
+
+static void gmf_scale_taps_clear ( ScaleTaps *taps )
+{
+	free ( taps->start );
+	free ( taps->n );
+	free ( taps->w );
+}
+
+// c * a / 255, rounded, without a division
+static inline uint8_t gmf_scale_mul ( uint c, uint a )
+{
+	uint x = c * a + 128;
+
+	return (uint8_t)( ( x + ( x >> 8 ) ) >> 8 );
+}
+
+static void gmf_scale_unpremul ( uint8_t *px, int n )
+{
+	int i = 0; for ( i = 0; i < n; i++, px += 4 )
+	{
+		uint a = px[3];
+
+		if ( a == 255 ) continue;
+
+		if ( a == 0 ) { px[0] = px[1] = px[2] = 0; continue; }
+
+		px[0] = (uint8_t)MIN ( 255u, ( px[0] * 255u + a / 2 ) / a );
+		px[1] = (uint8_t)MIN ( 255u, ( px[1] * 255u + a / 2 ) / a );
+		px[2] = (uint8_t)MIN ( 255u, ( px[2] * 255u + a / 2 ) / a );
+	}
+}
+
+// ***** Scalar *****
+
+static void gmf_scale_v_c ( const uint8_t *row, int16_t w, int n, uint32_t *acc )
+{
+	int i = 0; for ( i = 0; i < n; i++ ) acc[i] += (uint32_t)row[i] * (uint32_t)w;
+}
+
+static void gmf_scale_narrow_c ( const uint32_t *acc, int n, uint16_t *out )
+{
+	int i = 0; for ( i = 0; i < n; i++ ) out[i] = (uint16_t)( ( acc[i] + ( 1u << ( SCALE_BITS - SCALE_MID - 1 ) ) ) >> ( SCALE_BITS - SCALE_MID ) );
+}
+
+static void gmf_scale_h_c ( const uint16_t *src, int nc, const ScaleTaps *taps, int dw, uint8_t *out )
+{
+	int x = 0; for ( x = 0; x < dw; x++ )
+	{
+		const uint16_t *p = src + taps->start[x] * nc;
+		const int16_t *w = taps->w + (size_t)x * (size_t)taps->max_n;
+
+		uint32_t acc[4] = { 0, 0, 0, 0 };
+
+		int k = 0, c = 0; for ( k = 0; k < taps->n[x]; k++, p += nc )
+			for ( c = 0; c < nc; c++ ) acc[c] += (uint32_t)p[c] * (uint32_t)w[k];
+
+		for ( c = 0; c < nc; c++ ) out[x * nc + c] = (uint8_t)( ( acc[c] + ( 1u << ( SCALE_BITS + SCALE_MID - 1 ) ) ) >> ( SCALE_BITS + SCALE_MID ) );
+	}
+}
+
+static void gmf_scale_premul_c ( uint8_t *px, int n )
+{
+	int i = 0; for ( i = 0; i < n; i++, px += 4 )
+	{
+		px[0] = gmf_scale_mul ( px[0], px[3] );
+		px[1] = gmf_scale_mul ( px[1], px[3] );
+		px[2] = gmf_scale_mul ( px[2], px[3] );
+	}
+}
+
+static const ScaleKernels kernels_c = { "scalar", gmf_scale_v_c, gmf_scale_narrow_c, gmf_scale_h_c, gmf_scale_premul_c };
+
+// ***** SSE2 *****
+
+#if defined ( SCALE_SSE2 )
+
+static void gmf_scale_v_sse2 ( const uint8_t *row, int16_t w, int n, uint32_t *acc )
+{
+	const __m128i zero = _mm_setzero_si128 (), wv = _mm_set1_epi16 ( w );
+
+	int i = 0; for ( i = 0; i + 16 <= n; i += 16 )
+	{
+		__m128i v = _mm_loadu_si128 ( (const __m128i *)( row + i ) );
+
+		__m128i v0 = _mm_unpacklo_epi8 ( v, zero ), v1 = _mm_unpackhi_epi8 ( v, zero );
+
+		// 8 x 14 bits: the low and high halves of each product, zipped into 32 bits
+		__m128i lo0 = _mm_mullo_epi16 ( v0, wv ), hi0 = _mm_mulhi_epu16 ( v0, wv );
+		__m128i lo1 = _mm_mullo_epi16 ( v1, wv ), hi1 = _mm_mulhi_epu16 ( v1, wv );
+
+		__m128i *a = (__m128i *)( acc + i );
+
+		_mm_storeu_si128 ( a + 0, _mm_add_epi32 ( _mm_loadu_si128 ( a + 0 ), _mm_unpacklo_epi16 ( lo0, hi0 ) ) );
+		_mm_storeu_si128 ( a + 1, _mm_add_epi32 ( _mm_loadu_si128 ( a + 1 ), _mm_unpackhi_epi16 ( lo0, hi0 ) ) );
+		_mm_storeu_si128 ( a + 2, _mm_add_epi32 ( _mm_loadu_si128 ( a + 2 ), _mm_unpacklo_epi16 ( lo1, hi1 ) ) );
+		_mm_storeu_si128 ( a + 3, _mm_add_epi32 ( _mm_loadu_si128 ( a + 3 ), _mm_unpackhi_epi16 ( lo1, hi1 ) ) );
+	}
+
+	gmf_scale_v_c ( row + i, w, n - i, acc + i );
+}
+
+static void gmf_scale_narrow_sse2 ( const uint32_t *acc, int n, uint16_t *out )
+{
+	const __m128i round = _mm_set1_epi32 ( 1 << ( SCALE_BITS - SCALE_MID - 1 ) );
+
+	int i = 0; for ( i = 0; i + 8 <= n; i += 8 )
+	{
+		__m128i a0 = _mm_srli_epi32 ( _mm_add_epi32 ( _mm_loadu_si128 ( (const __m128i *)( acc + i ) ),     round ), SCALE_BITS - SCALE_MID );
+		__m128i a1 = _mm_srli_epi32 ( _mm_add_epi32 ( _mm_loadu_si128 ( (const __m128i *)( acc + i + 4 ) ), round ), SCALE_BITS - SCALE_MID );
+
+		// At most 255 << SCALE_MID: the signed pack does not saturate
+		_mm_storeu_si128 ( (__m128i *)( out + i ), _mm_packs_epi32 ( a0, a1 ) );
+	}
+
+	gmf_scale_narrow_c ( acc + i, n - i, out + i );
+}
+
+static inline __m128i gmf_scale_load_px_sse2 ( const uint16_t *p, int nc )
+{
+	uint64_t v = 0;
+
+	memcpy ( &v, p, (size_t)nc * sizeof ( uint16_t ) );
+
+	return _mm_loadl_epi64 ( (const __m128i *)&v );
+}
+
+// Two taps per step: the pixels interleaved channel by channel, so one madd weighs both
+static void gmf_scale_h_sse2 ( const uint16_t *src, int nc, const ScaleTaps *taps, int dw, uint8_t *out )
+{
+	const __m128i zero = _mm_setzero_si128 ();
+	const __m128i round = _mm_set1_epi32 ( 1 << ( SCALE_BITS + SCALE_MID - 1 ) );
+
+	int x = 0; for ( x = 0; x < dw; x++ )
+	{
+		const uint16_t *p = src + taps->start[x] * nc;
+		const int16_t *w = taps->w + (size_t)x * (size_t)taps->max_n;
+
+		__m128i acc = round;
+
+		int k = 0, n = taps->n[x];
+
+		for ( k = 0; k + 1 < n; k += 2 )
+		{
+			__m128i ab = _mm_unpacklo_epi16 ( gmf_scale_load_px_sse2 ( p + k * nc, nc ), gmf_scale_load_px_sse2 ( p + ( k + 1 ) * nc, nc ) );
+
+			__m128i wv = _mm_set1_epi32 ( (int)( (uint32_t)(uint16_t)w[k] | (uint32_t)(uint16_t)w[k + 1] << 16 ) );
+
+			acc = _mm_add_epi32 ( acc, _mm_madd_epi16 ( ab, wv ) );
+		}
+
+		if ( k < n )
+			acc = _mm_add_epi32 ( acc, _mm_madd_epi16 ( _mm_unpacklo_epi16 ( gmf_scale_load_px_sse2 ( p + k * nc, nc ), zero ), _mm_set1_epi32 ( (uint16_t)w[k] ) ) );
+
+		acc = _mm_srli_epi32 ( acc, SCALE_BITS + SCALE_MID );
+
+		uint32_t px = (uint32_t)_mm_cvtsi128_si32 ( _mm_packus_epi16 ( _mm_packs_epi32 ( acc, zero ), zero ) );
+
+		memcpy ( out + x * nc, &px, (size_t)nc );
+	}
+}
+
+static inline __m128i gmf_scale_premul_half_sse2 ( __m128i px, __m128i keep, __m128i opaque )
+{
+	__m128i a = _mm_shufflehi_epi16 ( _mm_shufflelo_epi16 ( px, _MM_SHUFFLE ( 3, 3, 3, 3 ) ), _MM_SHUFFLE ( 3, 3, 3, 3 ) );
+
+	// Alpha itself is multiplied by 255, which leaves it as it is
+	a = _mm_or_si128 ( _mm_and_si128 ( a, keep ), opaque );
+
+	__m128i x = _mm_add_epi16 ( _mm_mullo_epi16 ( px, a ), _mm_set1_epi16 ( 128 ) );
+
+	return _mm_srli_epi16 ( _mm_add_epi16 ( x, _mm_srli_epi16 ( x, 8 ) ), 8 );
+}
+
+static void gmf_scale_premul_sse2 ( uint8_t *px, int n )
+{
+	const __m128i zero = _mm_setzero_si128 ();
+	const __m128i keep = _mm_set_epi16 ( 0, -1, -1, -1, 0, -1, -1, -1 );
+	const __m128i opaque = _mm_set_epi16 ( 255, 0, 0, 0, 255, 0, 0, 0 );
+
+	int i = 0; for ( i = 0; i + 4 <= n; i += 4, px += 16 )
+	{
+		__m128i v = _mm_loadu_si128 ( (const __m128i *)px );
+
+		__m128i lo = gmf_scale_premul_half_sse2 ( _mm_unpacklo_epi8 ( v, zero ), keep, opaque );
+		__m128i hi = gmf_scale_premul_half_sse2 ( _mm_unpackhi_epi8 ( v, zero ), keep, opaque );
+
+		_mm_storeu_si128 ( (__m128i *)px, _mm_packus_epi16 ( lo, hi ) );
+	}
+
+	gmf_scale_premul_c ( px, n - i );
+}
+
+static const ScaleKernels kernels_sse2 = { "sse2", gmf_scale_v_sse2, gmf_scale_narrow_sse2, gmf_scale_h_sse2, gmf_scale_premul_sse2 };
+
+#endif
+
+// ***** AVX2 *****
+
+#if defined ( SCALE_AVX2 )
+
+SCALE_TARGET_AVX2 static void gmf_scale_v_avx2 ( const uint8_t *row, int16_t w, int n, uint32_t *acc )
+{
+	const __m256i wv = _mm256_set1_epi32 ( w );
+
+	int i = 0; for ( i = 0; i + 16 <= n; i += 16 )
+	{
+		__m128i v = _mm_loadu_si128 ( (const __m128i *)( row + i ) );
+
+		__m256i v0 = _mm256_cvtepu8_epi32 ( v ), v1 = _mm256_cvtepu8_epi32 ( _mm_srli_si128 ( v, 8 ) );
+
+		// 8 + 14 bits: madd on the zero-extended bytes gives the 32-bit products without the zip
+		__m256i *a = (__m256i *)( acc + i );
+
+		_mm256_storeu_si256 ( a + 0, _mm256_add_epi32 ( _mm256_loadu_si256 ( a + 0 ), _mm256_madd_epi16 ( v0, wv ) ) );
+		_mm256_storeu_si256 ( a + 1, _mm256_add_epi32 ( _mm256_loadu_si256 ( a + 1 ), _mm256_madd_epi16 ( v1, wv ) ) );
+	}
+
+	gmf_scale_v_sse2 ( row + i, w, n - i, acc + i );
+}
+
+SCALE_TARGET_AVX2 static inline __m256i gmf_scale_premul_half_avx2 ( __m256i px, __m256i keep, __m256i opaque )
+{
+	__m256i a = _mm256_shufflehi_epi16 ( _mm256_shufflelo_epi16 ( px, _MM_SHUFFLE ( 3, 3, 3, 3 ) ), _MM_SHUFFLE ( 3, 3, 3, 3 ) );
+
+	a = _mm256_or_si256 ( _mm256_and_si256 ( a, keep ), opaque );
+
+	__m256i x = _mm256_add_epi16 ( _mm256_mullo_epi16 ( px, a ), _mm256_set1_epi16 ( 128 ) );
+
+	return _mm256_srli_epi16 ( _mm256_add_epi16 ( x, _mm256_srli_epi16 ( x, 8 ) ), 8 );
+}
+
+SCALE_TARGET_AVX2 static void gmf_scale_premul_avx2 ( uint8_t *px, int n )
+{
+	const __m256i zero = _mm256_setzero_si256 ();
+	const __m256i keep = _mm256_set_epi16 ( 0, -1, -1, -1, 0, -1, -1, -1, 0, -1, -1, -1, 0, -1, -1, -1 );
+	const __m256i opaque = _mm256_set_epi16 ( 255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0 );
+
+	int i = 0; for ( i = 0; i + 8 <= n; i += 8, px += 32 )
+	{
+		__m256i v = _mm256_loadu_si256 ( (const __m256i *)px );
+
+		// Unpack and pack both stay inside each 128-bit lane, so the pixel order comes back unchanged
+		__m256i lo = gmf_scale_premul_half_avx2 ( _mm256_unpacklo_epi8 ( v, zero ), keep, opaque );
+		__m256i hi = gmf_scale_premul_half_avx2 ( _mm256_unpackhi_epi8 ( v, zero ), keep, opaque );
+
+		_mm256_storeu_si256 ( (__m256i *)px, _mm256_packus_epi16 ( lo, hi ) );
+	}
+
+	gmf_scale_premul_sse2 ( px, n - i );
+}
+
+// Narrowing and the x pass run once per output row: SSE2 is enough for them
+static const ScaleKernels kernels_avx2 = { "avx2", gmf_scale_v_avx2, gmf_scale_narrow_sse2, gmf_scale_h_sse2, gmf_scale_premul_avx2 };
+
+#endif
+
+// ***** NEON *****
+
+#if defined ( SCALE_NEON )
+
+static void gmf_scale_v_neon ( const uint8_t *row, int16_t w, int n, uint32_t *acc )
+{
+	int i = 0; for ( i = 0; i + 16 <= n; i += 16 )
+	{
+		uint8x16_t v = vld1q_u8 ( row + i );
+
+		uint16x8_t v0 = vmovl_u8 ( vget_low_u8 ( v ) ), v1 = vmovl_u8 ( vget_high_u8 ( v ) );
+
+		vst1q_u32 ( acc + i,      vmlal_n_u16 ( vld1q_u32 ( acc + i ),      vget_low_u16  ( v0 ), (uint16_t)w ) );
+		vst1q_u32 ( acc + i + 4,  vmlal_n_u16 ( vld1q_u32 ( acc + i + 4 ),  vget_high_u16 ( v0 ), (uint16_t)w ) );
+		vst1q_u32 ( acc + i + 8,  vmlal_n_u16 ( vld1q_u32 ( acc + i + 8 ),  vget_low_u16  ( v1 ), (uint16_t)w ) );
+		vst1q_u32 ( acc + i + 12, vmlal_n_u16 ( vld1q_u32 ( acc + i + 12 ), vget_high_u16 ( v1 ), (uint16_t)w ) );
+	}
+
+	gmf_scale_v_c ( row + i, w, n - i, acc + i );
+}
+
+static void gmf_scale_narrow_neon ( const uint32_t *acc, int n, uint16_t *out )
+{
+	int i = 0; for ( i = 0; i + 8 <= n; i += 8 )
+	{
+		uint16x4_t a0 = vrshrn_n_u32 ( vld1q_u32 ( acc + i ),     SCALE_BITS - SCALE_MID );
+		uint16x4_t a1 = vrshrn_n_u32 ( vld1q_u32 ( acc + i + 4 ), SCALE_BITS - SCALE_MID );
+
+		vst1q_u16 ( out + i, vcombine_u16 ( a0, a1 ) );
+	}
+
+	gmf_scale_narrow_c ( acc + i, n - i, out + i );
+}
+
+static void gmf_scale_h_neon ( const uint16_t *src, int nc, const ScaleTaps *taps, int dw, uint8_t *out )
+{
+	int x = 0; for ( x = 0; x < dw; x++ )
+	{
+		const uint16_t *p = src + taps->start[x] * nc;
+		const int16_t *w = taps->w + (size_t)x * (size_t)taps->max_n;
+
+		uint32x4_t acc = vdupq_n_u32 ( 0 );
+
+		int k = 0; for ( k = 0; k < taps->n[x]; k++, p += nc )
+		{
+			uint64_t v = 0;
+
+			memcpy ( &v, p, (size_t)nc * sizeof ( uint16_t ) );
+
+			acc = vmlal_n_u16 ( acc, vcreate_u16 ( v ), (uint16_t)w[k] );
+		}
+
+		uint16x4_t v = vmovn_u32 ( vrshrq_n_u32 ( acc, SCALE_BITS + SCALE_MID ) );
+
+		uint32_t px = vget_lane_u32 ( vreinterpret_u32_u8 ( vmovn_u16 ( vcombine_u16 ( v, vdup_n_u16 ( 0 ) ) ) ), 0 );
+
+		memcpy ( out + x * nc, &px, (size_t)nc );
+	}
+}
+
+static inline uint8x8_t gmf_scale_mul_neon ( uint8x8_t c, uint8x8_t a )
+{
+	uint16x8_t x = vmull_u8 ( c, a );
+
+	return vraddhn_u16 ( x, vrshrq_n_u16 ( x, 8 ) );
+}
+
+static void gmf_scale_premul_neon ( uint8_t *px, int n )
+{
+	int i = 0; for ( i = 0; i + 8 <= n; i += 8, px += 32 )
+	{
+		uint8x8x4_t v = vld4_u8 ( px );
+
+		v.val[0] = gmf_scale_mul_neon ( v.val[0], v.val[3] );
+		v.val[1] = gmf_scale_mul_neon ( v.val[1], v.val[3] );
+		v.val[2] = gmf_scale_mul_neon ( v.val[2], v.val[3] );
+
+		vst4_u8 ( px, v );
+	}
+
+	gmf_scale_premul_c ( px, n - i );
+}
+
+static const ScaleKernels kernels_neon = { "neon", gmf_scale_v_neon, gmf_scale_narrow_neon, gmf_scale_h_neon, gmf_scale_premul_neon };
+
+#endif
+
+// Picked once, from what the CPU running the binary supports
+static const ScaleKernels * gmf_scale_kernels ( void )
+{
+	static const ScaleKernels *kernels = NULL;
+
+	if ( g_once_init_enter ( &kernels ) )
+	{
+		const ScaleKernels *k = &kernels_c;
+
+#if defined ( SCALE_SSE2 )
+		k = &kernels_sse2;
+#endif
+
+#if defined ( SCALE_AVX2 )
+		if ( __builtin_cpu_supports ( "avx2" ) ) k = &kernels_avx2;
+#endif
+
+#if defined ( SCALE_NEON )
+		k = &kernels_neon;
+#endif
+
+		g_once_init_leave ( &kernels, k );
+	}
+
+	return kernels;
+}
+
+// The kernels in use, as bench/gmf-scale-bench reports them
+const char * gmf_scale_get_kernels_name ( void )
+{
+	return gmf_scale_kernels ()->name;
+}
+
+/* A new pixbuf of dw x dh, each pixel the coverage-weighted average of the source pixels under it.
+ * Alpha is premultiplied for the average. Anything other than an 8-bit RGB(A) downscale goes to
+ * gdk-pixbuf. A box filter only, no Lanczos: thumbnails shrink by 10x and more, where the box
+ * averages every source pixel without aliasing, while Lanczos would take several times the taps
+ * per pixel and ring around edges at icon sizes, for no visible gain. */
+GdkPixbuf * gmf_scale_down ( GdkPixbuf *src, int dw, int dh )
+{
+	int sw = gdk_pixbuf_get_width  ( src );
+	int sh = gdk_pixbuf_get_height ( src );
+	int nc = gdk_pixbuf_get_n_channels ( src );
+
+	gboolean alpha = gdk_pixbuf_get_has_alpha ( src );
+
+	if ( dw == sw && dh == sh ) return gdk_pixbuf_copy ( src );
+
+	if ( dw < 1 || dh < 1 || dw > sw || dh > sh || gdk_pixbuf_get_bits_per_sample ( src ) != 8 || nc != ( ( alpha ) ? 4 : 3 ) )
+		return gdk_pixbuf_scale_simple ( src, dw, dh, GDK_INTERP_BILINEAR );
+
+	GdkPixbuf *dst = gdk_pixbuf_new ( GDK_COLORSPACE_RGB, alpha, 8, dw, dh );
+
+	if ( !dst ) return NULL;
+
+	const ScaleKernels *kernels = gmf_scale_kernels ();
+
+	ScaleTaps tx, ty;
+	gmf_scale_taps_init ( &tx, sw, dw );
+	gmf_scale_taps_init ( &ty, sh, dh );
+
+	int n = sw * nc;
+
+	int src_stride = gdk_pixbuf_get_rowstride ( src );
+	int dst_stride = gdk_pixbuf_get_rowstride ( dst );
+
+	const uint8_t *src_px = gdk_pixbuf_get_pixels ( src );
+	uint8_t *dst_px = gdk_pixbuf_get_pixels ( dst );
+
+	uint32_t *acc = g_new ( uint32_t, (size_t)n );
+	uint16_t *mid = g_new ( uint16_t, (size_t)n );
+	uint8_t *prow = ( alpha ) ? g_malloc ( (size_t)n ) : NULL;
+
+	int y = 0; for ( y = 0; y < dh; y++ )
+	{
+		memset ( acc, 0, (size_t)n * sizeof ( uint32_t ) );
+
+		const int16_t *w = ty.w + (size_t)y * (size_t)ty.max_n;
+
+		int k = 0; for ( k = 0; k < ty.n[y]; k++ )
+		{
+			const uint8_t *row = src_px + (size_t)( ty.start[y] + k ) * (size_t)src_stride;
+
+			if ( alpha ) { memcpy ( prow, row, (size_t)n ); kernels->premul ( prow, sw ); row = prow; }
+
+			kernels->v ( row, w[k], n, acc );
+		}
+
+		uint8_t *out = dst_px + (size_t)y * (size_t)dst_stride;
+
+		kernels->narrow ( acc, n, mid );
+		kernels->h ( mid, nc, &tx, dw, out );
+
+		if ( alpha ) gmf_scale_unpremul ( out, dw );
+	}
+
+	free ( prow );
+	free ( mid );
+	free ( acc );
+
+	gmf_scale_taps_clear ( &tx );
+	gmf_scale_taps_clear ( &ty );
+
+	return dst;
+}
@@ -0,0 +1,16 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#pragma once
+
+#include <gtk/gtk.h>
+
+GdkPixbuf * gmf_scale_down ( GdkPixbuf *, int, int );
+
+const char * gmf_scale_get_kernels_name ( void );
@@ -0,0 +1,361 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#include "gmf-thumb-store.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+
+#define STORE_MAGIC   0x33534d47 // GMS3: files of GMS2 could be sparse
+#define STORE_SIZE    ( (uint64_t)128 << 20 )
+#define STORE_SLOTS   ( 1 << 16 )
+#define STORE_PROBES  64
+#define STORE_ALIGN   64
+#define STORE_PAGE    4096
+
+/* One file shared by every gmf process, mapped whole:
+ *
+ *   header | index: STORE_SLOTS x { hash, offset } | records, appended at tail
+ *
+ * Nothing is ever overwritten. A writer reserves its record by moving tail atomically, fills it,
+ * then publishes it: a compare-and-swap claims a free slot for the hash, the offset is stored
+ * after. A reader that finds the hash with no offset yet treats it as a miss. When the records
+ * or the index run out, the file is marked retired and a fresh one is renamed over it; processes
+ * move to the new file on their next access, pixbufs still pointing into the old one keep it mapped.
+ * The shared words are accessed with the GCC __atomic builtins, which work across processes. */
+
+typedef struct _StoreHeader StoreHeader;
+
+struct _StoreHeader
+{
+	uint32_t magic;
+	uint32_t n_slots;
+	uint64_t size;
+	uint64_t data;
+
+	uint64_t tail;
+	uint32_t count;
+	uint32_t retired;
+};
+
+typedef struct _StoreSlot StoreSlot;
+
+struct _StoreSlot
+{
+	uint64_t hash;
+	uint64_t offset;
+};
+
+typedef struct _StoreRecord StoreRecord;
+
+struct _StoreRecord
+{
+	uint64_t length;
+
+	uint64_t dev;
+	uint64_t inode;
+	uint64_t size;
+	int64_t mtime;
+
+	uint16_t icon_size;
+	uint16_t scale;
+	uint32_t is_link;
+
+	int32_t width;
+	int32_t height;
+	int32_t rowstride;
+	int32_t has_alpha;
+};
+
+#define STORE_RECORD ( ( sizeof ( StoreRecord ) + STORE_ALIGN - 1 ) & ~(size_t)( STORE_ALIGN - 1 ) )
+
+#define STORE_INDEX ( ( sizeof ( StoreHeader ) + STORE_PAGE - 1 ) & ~(size_t)( STORE_PAGE - 1 ) )
+#define STORE_DATA  ( STORE_INDEX + STORE_SLOTS * sizeof ( StoreSlot ) )
+
+typedef struct _StoreMap StoreMap;
+
+// Writes go through rw; pixbufs get pages of ro, so nothing can scribble on the shared file through them
+struct _StoreMap
+{
+	int ref;
+
+	uint8_t *rw;
+	uint8_t *ro;
+	size_t size;
+};
+
+G_LOCK_DEFINE_STATIC ( thumb_store );
+
+static StoreMap *store = NULL;
+static gboolean store_failed = FALSE;
+
+static void gmf_thumb_store_unref ( StoreMap *map )
+{
+	if ( !g_atomic_int_dec_and_test ( &map->ref ) ) return;
+
+	munmap ( map->rw, map->size );
+	munmap ( map->ro, map->size );
+
+	free ( map );
+}
+
+static void gmf_thumb_store_release ( G_GNUC_UNUSED guchar *pixels, gpointer map )
+{
+	gmf_thumb_store_unref ( (StoreMap *)map );
+}
+
+static uint64_t gmf_thumb_store_hash ( const GmfPixbufKey *key )
+{
+	uint64_t h = 0xCBF29CE484222325ULL;
+
+	uint64_t v[5] = { key->dev, key->inode, key->size, (uint64_t)key->mtime, (uint64_t)key->scale << 17 | (uint64_t)key->icon_size << 1 | ( key->is_link ? 1 : 0 ) };
+
+	uint i = 0; for ( i = 0; i < G_N_ELEMENTS ( v ); i++ ) { h ^= v[i]; h *= 0x100000001B3ULL; h ^= h >> 29; }
+
+	// 0 marks a free slot
+	return ( h ) ? h : 1;
+}
+
+static gboolean gmf_thumb_store_valid ( const uint8_t *base, size_t size )
+{
+	const StoreHeader *header = (const StoreHeader *)base;
+
+	return ( __atomic_load_n ( &header->magic, __ATOMIC_ACQUIRE ) == STORE_MAGIC && header->size == size && header->n_slots == STORE_SLOTS
+		&& header->data == STORE_DATA && !__atomic_load_n ( &header->retired, __ATOMIC_ACQUIRE ) );
+}
+
+static StoreMap * gmf_thumb_store_map ( int fd )
+{
+	StoreMap *map = g_new0 ( StoreMap, 1 );
+
+	map->ref = 1;
+	map->size = STORE_SIZE;
+	map->rw = mmap ( NULL, map->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+	map->ro = mmap ( NULL, map->size, PROT_READ, MAP_SHARED, fd, 0 );
+
+	if ( map->rw != MAP_FAILED && map->ro != MAP_FAILED ) return map;
+
+	if ( map->rw != MAP_FAILED ) munmap ( map->rw, map->size );
+	if ( map->ro != MAP_FAILED ) munmap ( map->ro, map->size );
+
+	free ( map );
+
+	return NULL;
+}
+
+/* A file of STORE_SIZE with an empty index, renamed into place once its header is complete. Every block
+ * is allocated up front: a store into a hole of a shared mapping on a full disk is a SIGBUS, not an error. */
+static StoreMap * gmf_thumb_store_create ( const char *path )
+{
+	g_autofree char *tmp = g_strconcat ( path, ".XXXXXX", NULL );
+
+	int fd = g_mkstemp_full ( tmp, O_RDWR | O_CLOEXEC, 0600 );
+
+	if ( fd == -1 ) return NULL;
+
+	StoreMap *map = ( posix_fallocate ( fd, 0, (off_t)STORE_SIZE ) == 0 ) ? gmf_thumb_store_map ( fd ) : NULL;
+
+	close ( fd );
+
+	if ( !map ) { g_unlink ( tmp ); return NULL; }
+
+	StoreHeader *header = (StoreHeader *)map->rw;
+
+	header->n_slots = STORE_SLOTS;
+	header->size = STORE_SIZE;
+	header->data = STORE_DATA;
+	header->tail = STORE_DATA;
+
+	__atomic_store_n ( &header->magic, STORE_MAGIC, __ATOMIC_RELEASE );
+
+	if ( g_rename ( tmp, path ) != 0 ) { g_unlink ( tmp ); gmf_thumb_store_unref ( map ); return NULL; }
+
+	return map;
+}
+
+// The current file, or a new one when there is none or it is retired; the lock file keeps processes from racing
+static StoreMap * gmf_thumb_store_open ( void )
+{
+	g_autofree char *dir  = g_build_filename ( g_get_user_cache_dir (), "gmf", NULL );
+	g_autofree char *path = g_build_filename ( dir, "thumbs-" VERSION ".store", NULL );
+	g_autofree char *lock = g_strconcat ( path, ".lock", NULL );
+
+	if ( g_mkdir_with_parents ( dir, 0700 ) != 0 ) return NULL;
+
+	int lock_fd = open ( lock, O_RDWR | O_CREAT | O_CLOEXEC, 0600 );
+
+	if ( lock_fd == -1 ) return NULL;
+
+	flock ( lock_fd, LOCK_EX );
+
+	StoreMap *map = NULL;
+
+	struct stat st;
+
+	int fd = open ( path, O_RDWR | O_CLOEXEC );
+
+	if ( fd != -1 && fstat ( fd, &st ) == 0 && (uint64_t)st.st_size == STORE_SIZE ) map = gmf_thumb_store_map ( fd );
+
+	if ( fd != -1 ) close ( fd );
+
+	if ( map && !gmf_thumb_store_valid ( map->ro, map->size ) ) { gmf_thumb_store_unref ( map ); map = NULL; }
+
+	if ( !map ) map = gmf_thumb_store_create ( path );
+
+	close ( lock_fd );
+
+	return map;
+}
+
+// A reference to the mapping in use; the next call after it was retired moves on to the new file
+static StoreMap * gmf_thumb_store_get ( void )
+{
+	G_LOCK ( thumb_store );
+
+	if ( store && !gmf_thumb_store_valid ( store->ro, store->size ) ) { gmf_thumb_store_unref ( store ); store = NULL; }
+
+	if ( !store && !store_failed ) store = gmf_thumb_store_open ();
+
+	// Nowhere to keep it (read-only home, no space): not tried again in this process
+	if ( !store ) store_failed = TRUE;
+
+	StoreMap *map = store;
+
+	if ( map ) g_atomic_int_inc ( &map->ref );
+
+	G_UNLOCK ( thumb_store );
+
+	return map;
+}
+
+static void gmf_thumb_store_retire ( StoreMap *map )
+{
+	__atomic_store_n ( &( (StoreHeader *)map->rw )->retired, 1, __ATOMIC_RELEASE );
+}
+
+static gboolean gmf_thumb_store_match ( const StoreRecord *rec, const GmfPixbufKey *key )
+{
+	return rec->inode == key->inode && rec->dev == key->dev && rec->size == key->size && rec->mtime == key->mtime
+		&& rec->icon_size == key->icon_size && rec->scale == key->scale && rec->is_link == (uint32_t)( key->is_link ? 1 : 0 );
+}
+
+/* A pixbuf over the mapped pixels, no copy, or NULL. It holds the mapping until it is finalized.
+ * The record is checked against the mapping's bounds: the file is shared and could be anything. */
+GdkPixbuf * gmf_thumb_store_lookup ( const GmfPixbufKey *key )
+{
+	StoreMap *map = gmf_thumb_store_get ();
+
+	if ( !map ) return NULL;
+
+	const StoreSlot *slots = (const StoreSlot *)( map->ro + STORE_INDEX );
+
+	uint64_t hash = gmf_thumb_store_hash ( key ), offset = 0;
+
+	uint i = 0; for ( i = 0; i < STORE_PROBES; i++ )
+	{
+		const StoreSlot *slot = &slots[( hash + i ) & ( STORE_SLOTS - 1 )];
+
+		uint64_t h = __atomic_load_n ( &slot->hash, __ATOMIC_ACQUIRE );
+
+		if ( h == 0 ) break;
+
+		if ( h == hash ) { offset = __atomic_load_n ( &slot->offset, __ATOMIC_ACQUIRE ); break; }
+	}
+
+	GdkPixbuf *pixbuf = NULL;
+
+	if ( offset >= STORE_DATA && offset <= map->size - STORE_RECORD )
+	{
+		const StoreRecord *rec = (const StoreRecord *)( map->ro + offset );
+
+		int nc = ( rec->has_alpha ) ? 4 : 3;
+
+		uint64_t row = (uint64_t)rec->width * (uint64_t)nc;
+
+		gboolean fits = ( rec->length >= STORE_RECORD && rec->length <= map->size - offset && rec->width > 0 && rec->height > 0
+			&& rec->rowstride > 0 && (uint64_t)rec->rowstride >= row && (uint64_t)rec->rowstride * (uint64_t)( rec->height - 1 ) + row <= rec->length - STORE_RECORD );
+
+		if ( fits && gmf_thumb_store_match ( rec, key ) )
+		{
+			g_atomic_int_inc ( &map->ref );
+
+			pixbuf = gdk_pixbuf_new_from_data ( map->ro + offset + STORE_RECORD, GDK_COLORSPACE_RGB, rec->has_alpha != 0, 8,
+				rec->width, rec->height, rec->rowstride, gmf_thumb_store_release, map );
+		}
+	}
+
+	gmf_thumb_store_unref ( map );
+
+	return pixbuf;
+}
+
+// Appends the pixels and publishes them; a full file is retired and the thumbnail left to the next one
+void gmf_thumb_store_insert ( const GmfPixbufKey *key, GdkPixbuf *pixbuf )
+{
+	if ( gdk_pixbuf_get_bits_per_sample ( pixbuf ) != 8 || gdk_pixbuf_get_n_channels ( pixbuf ) != ( gdk_pixbuf_get_has_alpha ( pixbuf ) ? 4 : 3 ) ) return;
+
+	StoreMap *map = gmf_thumb_store_get ();
+
+	if ( !map ) return;
+
+	StoreHeader *header = (StoreHeader *)map->rw;
+	StoreSlot *slots = (StoreSlot *)( map->rw + STORE_INDEX );
+
+	int w = gdk_pixbuf_get_width  ( pixbuf );
+	int h = gdk_pixbuf_get_height ( pixbuf );
+	int rowstride = gdk_pixbuf_get_rowstride ( pixbuf );
+
+	uint64_t length = ( STORE_RECORD + (uint64_t)rowstride * (uint64_t)h + STORE_ALIGN - 1 ) & ~(uint64_t)( STORE_ALIGN - 1 );
+
+	uint64_t offset = __atomic_fetch_add ( &header->tail, length, __ATOMIC_ACQ_REL );
+
+	if ( offset < STORE_DATA || offset + length > map->size || __atomic_add_fetch ( &header->count, 1, __ATOMIC_ACQ_REL ) > STORE_SLOTS / 4 * 3 )
+		{ gmf_thumb_store_retire ( map ); gmf_thumb_store_unref ( map ); return; }
+
+	StoreRecord *rec = (StoreRecord *)( map->rw + offset );
+
+	rec->length = length;
+	rec->dev = key->dev;
+	rec->inode = key->inode;
+	rec->size = key->size;
+	rec->mtime = key->mtime;
+	rec->icon_size = key->icon_size;
+	rec->scale = key->scale;
+	rec->is_link = ( key->is_link ) ? 1 : 0;
+	rec->width = w;
+	rec->height = h;
+	rec->rowstride = rowstride;
+	rec->has_alpha = gdk_pixbuf_get_has_alpha ( pixbuf );
+
+	// The last row of a pixbuf may be shorter than its rowstride
+	memcpy ( map->rw + offset + STORE_RECORD, gdk_pixbuf_get_pixels ( pixbuf ), (size_t)rowstride * (size_t)( h - 1 ) + (size_t)gdk_pixbuf_get_width ( pixbuf ) * (size_t)gdk_pixbuf_get_n_channels ( pixbuf ) );
+
+	uint64_t hash = gmf_thumb_store_hash ( key );
+
+	uint i = 0; for ( i = 0; i < STORE_PROBES; i++ )
+	{
+		StoreSlot *slot = &slots[( hash + i ) & ( STORE_SLOTS - 1 )];
+
+		uint64_t free_hash = 0;
+
+		if ( __atomic_compare_exchange_n ( &slot->hash, &free_hash, hash, FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ) )
+			{ __atomic_store_n ( &slot->offset, offset, __ATOMIC_RELEASE ); break; }
+
+		// Another window got there first
+		if ( free_hash == hash ) break;
+	}
+
+	if ( i == STORE_PROBES ) gmf_thumb_store_retire ( map );
+
+	gmf_thumb_store_unref ( map );
+}
@@ -0,0 +1,15 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#pragma once
+
+#include "gmf-pixbuf-cache.h"
+
+GdkPixbuf * gmf_thumb_store_lookup ( const GmfPixbufKey * );
+void gmf_thumb_store_insert ( const GmfPixbufKey *, GdkPixbuf * );
@@ -0,0 +1,608 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#include "gmf-thumb.h"
+#include "gmf-jpeg.h"
+#include "gmf-scale.h"
+#include "gmf-thumbnailer.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+
+#define THUMB_FAIL "fail/gmf-" VERSION
+
+// Images above either limit are not decoded at all: the view keeps their MIME icon.
+// The byte cap also bounds what one read holds in memory before the decode.
+#define THUMB_MAX_PIXELS ( 50 * 1000 * 1000 )
+#define THUMB_MAX_BYTES ( 64 << 20 )
+#define THUMB_CHUNK ( 64 * 1024 )
+
+// What a preview reads of a file: room for the JPEG markers before the image data, EXIF at most 64K
+#define THUMB_PREVIEW_HEAD ( 128 * 1024 )
+
+// Thumbnail Managing Standard: https://specifications.freedesktop.org/thumbnail-spec/
+typedef struct _ThumbFlavor ThumbFlavor;
+
+struct _ThumbFlavor
+{
+	const char *name;
+	int size;
+};
+
+static const ThumbFlavor flavors[] = { { "normal", 128 }, { "large", 256 }, { "x-large", 512 }, { "xx-large", 1024 } };
+
+typedef struct _ThumbInfo ThumbInfo;
+
+struct _ThumbInfo
+{
+	char *uri;
+	char *md5;
+	char *mtime;
+	char *size;
+};
+
+static char * gmf_thumb_dir ( void )
+{
+	return g_build_filename ( g_get_user_cache_dir (), "thumbnails", NULL );
+}
+
+static gboolean gmf_thumb_info_init ( const char *path, ThumbInfo *info )
+{
+	struct stat st;
+
+	if ( stat ( path, &st ) != 0 ) return FALSE;
+
+	info->uri = g_filename_to_uri ( path, NULL, NULL );
+
+	if ( !info->uri ) return FALSE;
+
+	info->md5   = g_compute_checksum_for_string ( G_CHECKSUM_MD5, info->uri, -1 );
+	info->mtime = g_strdup_printf ( "%" G_GINT64_FORMAT, (int64_t)st.st_mtime );
+	info->size  = g_strdup_printf ( "%" G_GINT64_FORMAT, (int64_t)st.st_size  );
+
+	return TRUE;
+}
+
+static void gmf_thumb_info_clear ( ThumbInfo *info )
+{
+	free ( info->uri );
+	free ( info->md5 );
+	free ( info->mtime );
+	free ( info->size );
+}
+
+static char * gmf_thumb_file ( const char *sub_dir, ThumbInfo *info )
+{
+	g_autofree char *dir  = gmf_thumb_dir ();
+	g_autofree char *name = g_strconcat ( info->md5, ".png", NULL );
+
+	return g_build_filename ( dir, sub_dir, name, NULL );
+}
+
+// A thumbnail is valid only for the exact URI and modification time it was made from
+static GdkPixbuf * gmf_thumb_read ( const char *file, ThumbInfo *info )
+{
+	GdkPixbuf *pixbuf = gdk_pixbuf_new_from_file ( file, NULL );
+
+	if ( !pixbuf ) return NULL;
+
+	const char *uri   = gdk_pixbuf_get_option ( pixbuf, "tEXt::Thumb::URI"   );
+	const char *mtime = gdk_pixbuf_get_option ( pixbuf, "tEXt::Thumb::MTime" );
+
+	if ( uri && mtime && g_str_equal ( uri, info->uri ) && g_str_equal ( mtime, info->mtime ) ) return pixbuf;
+
+	g_object_unref ( pixbuf );
+
+	return NULL;
+}
+
+// Written to a temporary file next to the target and renamed, so readers never see a partial PNG
+static void gmf_thumb_write ( GdkPixbuf *pixbuf, const char *file, ThumbInfo *info )
+{
+	g_autofree char *dir = g_path_get_dirname ( file );
+
+	if ( g_mkdir_with_parents ( dir, 0700 ) != 0 ) return;
+
+	g_autofree char *tmp = g_strconcat ( file, ".XXXXXX", NULL );
+
+	int fd = g_mkstemp_full ( tmp, O_WRONLY, 0600 );
+
+	if ( fd == -1 ) return;
+
+	close ( fd );
+
+	gboolean saved = gdk_pixbuf_save ( pixbuf, tmp, "png", NULL,
+		"tEXt::Thumb::URI",   info->uri,
+		"tEXt::Thumb::MTime", info->mtime,
+		"tEXt::Thumb::Size",  info->size,
+		"tEXt::Software",     "Gmf",
+		NULL );
+
+	if ( !saved || g_rename ( tmp, file ) != 0 ) g_unlink ( tmp );
+}
+
+// A transparent 1x1 PNG with the usual keys: the file cannot be thumbnailed until it changes
+static void gmf_thumb_write_fail ( ThumbInfo *info )
+{
+	g_autofree char *fail = gmf_thumb_file ( THUMB_FAIL, info );
+
+	GdkPixbuf *mark = gdk_pixbuf_new ( GDK_COLORSPACE_RGB, TRUE, 8, 1, 1 );
+
+	gdk_pixbuf_fill ( mark, 0 );
+
+	gmf_thumb_write ( mark, fail, info );
+
+	g_object_unref ( mark );
+}
+
+// The whole file in memory, NULL when it cannot be read or is over the byte cap
+static GBytes * gmf_thumb_read_bytes ( const char *path )
+{
+	struct stat st;
+
+	int fd = open ( path, O_RDONLY | O_CLOEXEC );
+
+	if ( fd == -1 ) return NULL;
+
+	if ( fstat ( fd, &st ) != 0 || !S_ISREG ( st.st_mode ) || st.st_size > THUMB_MAX_BYTES ) { close ( fd ); return NULL; }
+
+	posix_fadvise ( fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+
+	size_t size = (size_t)st.st_size, done = 0;
+
+	uint8_t *buf = g_malloc ( MAX ( size, 1 ) );
+
+	ssize_t len = 0;
+
+	while ( done < size && ( len = read ( fd, buf + done, size - done ) ) > 0 ) done += (size_t)len;
+
+	close ( fd );
+
+	if ( len < 0 ) { free ( buf ); return NULL; }
+
+	return g_bytes_new_take ( buf, done );
+}
+
+// The first bytes of path, for the headers alone; whole tells whether that was all of it
+static GBytes * gmf_thumb_read_head ( const char *path, size_t max, gboolean *whole )
+{
+	struct stat st;
+
+	int fd = open ( path, O_RDONLY | O_CLOEXEC );
+
+	if ( fd == -1 ) return NULL;
+
+	if ( fstat ( fd, &st ) != 0 || !S_ISREG ( st.st_mode ) ) { close ( fd ); return NULL; }
+
+	size_t size = MIN ( (size_t)st.st_size, max ), done = 0;
+
+	uint8_t *buf = g_malloc ( MAX ( size, 1 ) );
+
+	ssize_t len = 0;
+
+	while ( done < size && ( len = read ( fd, buf + done, size - done ) ) > 0 ) done += (size_t)len;
+
+	close ( fd );
+
+	if ( len < 0 ) { free ( buf ); return NULL; }
+
+	*whole = ( done == (size_t)st.st_size );
+
+	return g_bytes_new_take ( buf, done );
+}
+
+typedef struct _ThumbStream ThumbStream;
+
+struct _ThumbStream
+{
+	int size;
+	gboolean over;
+};
+
+// A 0x0 size makes the loader give up before it allocates anything; size 0 keeps the image as it is
+static void gmf_thumb_size_prepared ( GdkPixbufLoader *loader, int w, int h, ThumbStream *ts )
+{
+	if ( (uint64_t)w * (uint64_t)h > THUMB_MAX_PIXELS ) { ts->over = TRUE; gdk_pixbuf_loader_set_size ( loader, 0, 0 ); return; }
+
+	if ( !ts->size ) return;
+
+	double k = (double)ts->size / MAX ( w, h );
+
+	gdk_pixbuf_loader_set_size ( loader, MAX ( 1, (int)( w * k + 0.5 ) ), MAX ( 1, (int)( h * k + 0.5 ) ) );
+}
+
+// Fed in chunks, so the header is seen first: an image over the pixel cap stops there
+static GdkPixbuf * gmf_thumb_stream ( GBytes *bytes, int size )
+{
+	gsize len = 0, pos = 0;
+	const uint8_t *data = g_bytes_get_data ( bytes, &len );
+
+	ThumbStream ts = { size, FALSE };
+
+	GdkPixbufLoader *loader = gdk_pixbuf_loader_new ();
+	g_signal_connect ( loader, "size-prepared", G_CALLBACK ( gmf_thumb_size_prepared ), &ts );
+
+	gboolean ok = TRUE;
+
+	while ( ok && !ts.over && pos < len )
+	{
+		gsize n = MIN ( (gsize)THUMB_CHUNK, len - pos );
+
+		ok = gdk_pixbuf_loader_write ( loader, data + pos, n, NULL );
+
+		pos += n;
+	}
+
+	ok = gdk_pixbuf_loader_close ( loader, NULL ) && ok && !ts.over;
+
+	GdkPixbuf *pixbuf = ( ok ) ? gdk_pixbuf_loader_get_pixbuf ( loader ) : NULL;
+
+	if ( pixbuf ) pixbuf = gdk_pixbuf_apply_embedded_orientation ( pixbuf );
+
+	g_object_unref ( loader );
+
+	return pixbuf;
+}
+
+// Camera JPEGs take the fast path, everything else goes through gdk-pixbuf
+static GdkPixbuf * gmf_thumb_decode ( GBytes *bytes, int size )
+{
+	gsize len = 0;
+	const uint8_t *data = g_bytes_get_data ( bytes, &len );
+
+	GdkPixbuf *pixbuf = gmf_jpeg_load ( data, len, size );
+
+	return ( pixbuf ) ? pixbuf : gmf_thumb_stream ( bytes, size );
+}
+
+static GdkPixbuf * gmf_thumb_load ( const char *path, int size )
+{
+	GBytes *bytes = gmf_thumb_read_bytes ( path );
+
+	if ( !bytes ) return NULL;
+
+	GdkPixbuf *pixbuf = gmf_thumb_decode ( bytes, size );
+
+	g_bytes_unref ( bytes );
+
+	return pixbuf;
+}
+
+// Takes pixbuf over: it is returned as is when it fits icon_size already, scaled down otherwise
+GdkPixbuf * gmf_thumb_scale ( GdkPixbuf *pixbuf, uint16_t icon_size )
+{
+	int w = gdk_pixbuf_get_width  ( pixbuf );
+	int h = gdk_pixbuf_get_height ( pixbuf );
+
+	if ( w <= icon_size && h <= icon_size ) return pixbuf;
+
+	double k = (double)icon_size / MAX ( w, h );
+
+	GdkPixbuf *scaled = gmf_scale_down ( pixbuf, MAX ( 1, (int)( w * k ) ), MAX ( 1, (int)( h * k ) ) );
+
+	g_object_unref ( pixbuf );
+
+	return scaled;
+}
+
+/* A quick stand-in shown while the view scrolls, only from what is cheap to get: a valid thumbnail
+ * another program already made, or for a JPEG the EXIF thumbnail in its headers, else a decode at 1/8
+ * or so in the DCT domain. Anything else would cost a full decode: NULL, and the view keeps the MIME
+ * icon until the real thumbnail. Never written back. */
+GdkPixbuf * gmf_thumb_get_preview ( const char *path, uint16_t icon_size )
+{
+	ThumbInfo info = { NULL, NULL, NULL, NULL };
+
+	GdkPixbuf *pixbuf = NULL;
+
+	if ( gmf_thumb_info_init ( path, &info ) )
+	{
+		uint8_t n_flavors = (uint8_t)G_N_ELEMENTS ( flavors ), f = 0;
+
+		for ( f = 0; f < n_flavors && !pixbuf; f++ )
+		{
+			g_autofree char *file = gmf_thumb_file ( flavors[f].name, &info );
+
+			if ( g_file_test ( file, G_FILE_TEST_EXISTS ) ) pixbuf = gmf_thumb_read ( file, &info );
+		}
+
+		g_autofree char *fail = gmf_thumb_file ( THUMB_FAIL, &info );
+
+		// Known to fail or to be over the limits: not worth a preview either
+		if ( !pixbuf && g_file_test ( fail, G_FILE_TEST_EXISTS ) ) { gmf_thumb_info_clear ( &info ); return NULL; }
+	}
+
+	gmf_thumb_info_clear ( &info );
+
+	if ( pixbuf ) return gmf_thumb_scale ( pixbuf, icon_size );
+
+	gboolean whole = FALSE;
+	GBytes *bytes = gmf_thumb_read_head ( path, THUMB_PREVIEW_HEAD, &whole );
+
+	if ( !bytes ) return NULL;
+
+	gsize len = 0;
+	const uint8_t *data = g_bytes_get_data ( bytes, &len );
+
+	if ( gmf_jpeg_is_jpeg ( data, len ) ) pixbuf = gmf_jpeg_load_exif ( data, len );
+
+	// No EXIF thumbnail: the DCT decode needs the whole file, but no more than the entropy decoding of it
+	if ( !pixbuf && gmf_jpeg_is_jpeg ( data, len ) )
+	{
+		if ( !whole ) { g_bytes_unref ( bytes ); bytes = gmf_thumb_read_bytes ( path ); }
+
+		data = ( bytes ) ? g_bytes_get_data ( bytes, &len ) : NULL;
+
+		if ( data ) pixbuf = gmf_jpeg_load ( data, len, MAX ( icon_size / 4, 16 ) );
+	}
+
+	if ( bytes ) g_bytes_unref ( bytes );
+
+	if ( !pixbuf ) return NULL;
+
+	int w = gdk_pixbuf_get_width  ( pixbuf );
+	int h = gdk_pixbuf_get_height ( pixbuf );
+
+	double k = (double)icon_size / MAX ( w, h );
+
+	// Brought to the final size, so the tile does not jump when the real thumbnail replaces it
+	GdkPixbuf *scaled = gdk_pixbuf_scale_simple ( pixbuf, MAX ( 1, (int)( w * k ) ), MAX ( 1, (int)( h * k ) ), GDK_INTERP_BILINEAR );
+
+	g_object_unref ( pixbuf );
+
+	return scaled;
+}
+
+// ***** Read and decode stages *****
+
+#define THUMB_ORIGINAL -1
+#define THUMB_FAILED   -2
+
+struct _GmfThumbData
+{
+	char *path;
+	uint16_t icon_size;
+
+	ThumbInfo info;
+	gboolean cached;
+
+	// The flavor the bytes are a thumbnail of, or the original file, or the fail mark
+	int8_t flavor;
+	int8_t first;
+
+	GBytes *bytes;
+};
+
+static int8_t gmf_thumb_flavor_first ( uint16_t icon_size )
+{
+	int8_t n_flavors = (int8_t)G_N_ELEMENTS ( flavors ), first = 0;
+
+	while ( first < n_flavors - 1 && flavors[first].size < icon_size ) first++;
+
+	return first;
+}
+
+static gboolean gmf_thumb_valid ( GdkPixbuf *pixbuf, ThumbInfo *info )
+{
+	const char *uri   = gdk_pixbuf_get_option ( pixbuf, "tEXt::Thumb::URI"   );
+	const char *mtime = gdk_pixbuf_get_option ( pixbuf, "tEXt::Thumb::MTime" );
+
+	return ( uri && mtime && g_str_equal ( uri, info->uri ) && g_str_equal ( mtime, info->mtime ) );
+}
+
+/* I/O only: the bytes gmf_thumb_data_decode needs for path - the first cached thumbnail of
+ * the right size or bigger, else the fail mark, else the image itself. Nothing is decoded here. */
+GmfThumbData * gmf_thumb_data_read ( const char *path, uint16_t icon_size )
+{
+	GmfThumbData *data = g_new0 ( GmfThumbData, 1 );
+
+	data->path = g_strdup ( path );
+	data->icon_size = icon_size;
+	data->flavor = THUMB_ORIGINAL;
+	data->first = gmf_thumb_flavor_first ( icon_size );
+
+	g_autofree char *cache_dir = gmf_thumb_dir ();
+
+	// Never thumbnail the thumbnails
+	data->cached = !g_str_has_prefix ( path, cache_dir ) && gmf_thumb_info_init ( path, &data->info );
+
+	if ( data->cached )
+	{
+		int8_t n_flavors = (int8_t)G_N_ELEMENTS ( flavors ), f = 0;
+
+		// The matching size first, then any bigger one another program may have made
+		for ( f = data->first; f < n_flavors && !data->bytes; f++ )
+		{
+			g_autofree char *file = gmf_thumb_file ( flavors[f].name, &data->info );
+
+			if ( ( data->bytes = gmf_thumb_read_bytes ( file ) ) ) data->flavor = f;
+		}
+
+		if ( !data->bytes )
+		{
+			g_autofree char *fail = gmf_thumb_file ( THUMB_FAIL, &data->info );
+
+			if ( ( data->bytes = gmf_thumb_read_bytes ( fail ) ) ) data->flavor = THUMB_FAILED;
+		}
+	}
+
+	if ( !data->bytes ) data->bytes = gmf_thumb_read_bytes ( path );
+
+	return data;
+}
+
+/* CPU only, apart from a stale cache entry (the original is read after all) and the write back:
+ * the thumbnail from the bytes gmf_thumb_data_read got, or NULL when there is none. */
+GdkPixbuf * gmf_thumb_data_decode ( GmfThumbData *data )
+{
+	if ( data->flavor != THUMB_ORIGINAL )
+	{
+		GdkPixbuf *thumb = ( data->bytes ) ? gmf_thumb_stream ( data->bytes, 0 ) : NULL;
+
+		gboolean valid = ( thumb && gmf_thumb_valid ( thumb, &data->info ) );
+
+		if ( valid && data->flavor == THUMB_FAILED ) { g_object_unref ( thumb ); return NULL; }
+
+		if ( valid ) return gmf_thumb_scale ( thumb, data->icon_size );
+
+		if ( thumb ) g_object_unref ( thumb );
+
+		if ( data->bytes ) g_bytes_unref ( data->bytes );
+
+		data->bytes = gmf_thumb_read_bytes ( data->path );
+		data->flavor = THUMB_ORIGINAL;
+	}
+
+	int size = ( data->cached ) ? flavors[data->first].size : data->icon_size;
+
+	GdkPixbuf *pixbuf = ( data->bytes ) ? gmf_thumb_decode ( data->bytes, size ) : NULL;
+
+	if ( !data->cached ) return pixbuf;
+
+	if ( pixbuf )
+	{
+		g_autofree char *file = gmf_thumb_file ( flavors[data->first].name, &data->info );
+
+		gmf_thumb_write ( pixbuf, file, &data->info );
+	}
+	else
+		gmf_thumb_write_fail ( &data->info );
+
+	return ( pixbuf ) ? gmf_thumb_scale ( pixbuf, data->icon_size ) : NULL;
+}
+
+size_t gmf_thumb_data_get_size ( GmfThumbData *data )
+{
+	return ( data->bytes ) ? g_bytes_get_size ( data->bytes ) : 0;
+}
+
+void gmf_thumb_data_free ( GmfThumbData *data )
+{
+	if ( data->bytes ) g_bytes_unref ( data->bytes );
+
+	gmf_thumb_info_clear ( &data->info );
+
+	free ( data->path );
+	free ( data );
+}
+
+/* Image thumbnail for path, no bigger than icon_size: taken from the shared thumbnail cache when
+ * a valid one exists, otherwise decoded once and stored there (or in fail/ when it cannot be read). */
+GdkPixbuf * gmf_thumb_get ( const char *path, uint16_t icon_size )
+{
+	GmfThumbData *data = gmf_thumb_data_read ( path, icon_size );
+
+	GdkPixbuf *pixbuf = gmf_thumb_data_decode ( data );
+
+	gmf_thumb_data_free ( data );
+
+	return pixbuf;
+}
+
+// ***** External thumbnailers *****
+
+typedef struct _ThumbExternal ThumbExternal;
+
+struct _ThumbExternal
+{
+	ThumbInfo info;
+	uint16_t icon_size;
+	int size;
+
+	char *file;
+	char *tmp;
+
+	GmfThumbFunc func;
+	gpointer data;
+};
+
+// Runner thread: the child's PNG gets the cache keys it lacks and takes its place in the cache
+static void gmf_thumb_external_done ( uint8_t ret, ThumbExternal *ext )
+{
+	GdkPixbuf *pixbuf = ( ret == GMF_THUMBNAILER_DONE ) ? gmf_thumb_load ( ext->tmp, ext->size ) : NULL;
+
+	g_unlink ( ext->tmp );
+
+	if ( pixbuf ) gmf_thumb_write ( pixbuf, ext->file, &ext->info );
+
+	// A thumbnailer that exits 0 but leaves no loadable PNG fails the same way on every visit
+	if ( !pixbuf && ret != GMF_THUMBNAILER_CANCELLED ) gmf_thumb_write_fail ( &ext->info );
+
+	ext->func ( ( pixbuf ) ? gmf_thumb_scale ( pixbuf, ext->icon_size ) : NULL, ext->data );
+
+	gmf_thumb_info_clear ( &ext->info );
+
+	free ( ext->file );
+	free ( ext->tmp );
+	free ( ext );
+}
+
+/* Thumbnail of a type gdk-pixbuf cannot load, by the installed thumbnailer for content_type.
+ * FALSE when there is none; otherwise func gets the thumbnail, or NULL, exactly once: right away
+ * from the cache or the fail mark, later from a runner thread when a child has to make it. */
+gboolean gmf_thumb_external ( const char *path, const char *content_type, uint16_t icon_size, const int *cancel, GmfThumbFunc func, gpointer data )
+{
+	if ( !gmf_thumbnailer_supports ( content_type ) ) return FALSE;
+
+	ThumbInfo info = { NULL, NULL, NULL, NULL };
+
+	if ( !gmf_thumb_info_init ( path, &info ) ) { gmf_thumb_info_clear ( &info ); return FALSE; }
+
+	int8_t n_flavors = (int8_t)G_N_ELEMENTS ( flavors ), first = gmf_thumb_flavor_first ( icon_size ), f = 0;
+
+	GdkPixbuf *pixbuf = NULL;
+
+	for ( f = first; f < n_flavors && !pixbuf; f++ )
+	{
+		g_autofree char *file = gmf_thumb_file ( flavors[f].name, &info );
+
+		pixbuf = gmf_thumb_read ( file, &info );
+	}
+
+	g_autofree char *fail = gmf_thumb_file ( THUMB_FAIL, &info );
+
+	GdkPixbuf *failed = ( !pixbuf ) ? gmf_thumb_read ( fail, &info ) : NULL;
+
+	if ( pixbuf || failed )
+	{
+		if ( failed ) g_object_unref ( failed );
+
+		gmf_thumb_info_clear ( &info );
+
+		func ( ( pixbuf ) ? gmf_thumb_scale ( pixbuf, icon_size ) : NULL, data );
+
+		return TRUE;
+	}
+
+	ThumbExternal *ext = g_new0 ( ThumbExternal, 1 );
+
+	ext->info = info;
+	ext->icon_size = icon_size;
+	ext->size = flavors[first].size;
+	ext->file = gmf_thumb_file ( flavors[first].name, &info );
+	ext->func = func;
+	ext->data = data;
+
+	g_autofree char *dir = g_path_get_dirname ( ext->file );
+
+	// Next to the target, and named .png: some thumbnailers pick the format by the extension
+	ext->tmp = g_strconcat ( ext->file, ".XXXXXX.png", NULL );
+
+	int fd = ( g_mkdir_with_parents ( dir, 0700 ) == 0 ) ? g_mkstemp_full ( ext->tmp, O_WRONLY, 0600 ) : -1;
+
+	if ( fd == -1 ) { gmf_thumb_external_done ( GMF_THUMBNAILER_CANCELLED, ext ); return TRUE; }
+
+	close ( fd );
+
+	gmf_thumbnailer_run ( path, content_type, ext->size, ext->tmp, cancel, (GmfThumbnailerFunc)gmf_thumb_external_done, ext );
+
+	return TRUE;
+}
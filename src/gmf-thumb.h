@@ -0,0 +1,29 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#pragma once
+
+#include <gtk/gtk.h>
+
+GdkPixbuf * gmf_thumb_get ( const char *, uint16_t );
+GdkPixbuf * gmf_thumb_get_preview ( const char *, uint16_t );
+
+GdkPixbuf * gmf_thumb_scale ( GdkPixbuf *, uint16_t );
+
+typedef struct _GmfThumbData GmfThumbData;
+
+GmfThumbData * gmf_thumb_data_read ( const char *, uint16_t );
+GdkPixbuf * gmf_thumb_data_decode ( GmfThumbData * );
+
+size_t gmf_thumb_data_get_size ( GmfThumbData * );
+void gmf_thumb_data_free ( GmfThumbData * );
+
+typedef void ( *GmfThumbFunc ) ( GdkPixbuf *, gpointer );
+
+gboolean gmf_thumb_external ( const char *, const char *, uint16_t, const int *, GmfThumbFunc, gpointer );
@@ -0,0 +1,224 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#include "gmf-thumbnailer.h"
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#define THUMBNAILER_MAX     2     // children at once
+#define THUMBNAILER_TIMEOUT 10    // s
+#define THUMBNAILER_POLL    20000 // us
+#define THUMBNAILER_MEMORY  ( (rlim_t)1024 << 20 )
+
+typedef struct _ThumbnailerTask ThumbnailerTask;
+
+struct _ThumbnailerTask
+{
+	char **argv;
+	const int *cancel;
+
+	GmfThumbnailerFunc func;
+	gpointer data;
+};
+
+G_LOCK_DEFINE_STATIC ( thumbnailers );
+
+// Content type -> Exec line of the .thumbnailer entry that handles it
+static GHashTable *thumbnailers = NULL;
+
+static GThreadPool *runners = NULL;
+
+// Desktop entry of the Thumbnailer spec: the first entry for a type wins, user entries come first
+static void gmf_thumbnailer_load_dir ( const char *data_dir )
+{
+	g_autofree char *path = g_build_filename ( data_dir, "thumbnailers", NULL );
+
+	GDir *dir = g_dir_open ( path, 0, NULL );
+
+	if ( !dir ) return;
+
+	const char *name = NULL;
+
+	while ( ( name = g_dir_read_name ( dir ) ) )
+	{
+		if ( !g_str_has_suffix ( name, ".thumbnailer" ) ) continue;
+
+		g_autofree char *file = g_build_filename ( path, name, NULL );
+
+		GKeyFile *key_file = g_key_file_new ();
+
+		if ( g_key_file_load_from_file ( key_file, file, G_KEY_FILE_NONE, NULL ) )
+		{
+			g_autofree char *exec = g_key_file_get_string ( key_file, "Thumbnailer Entry", "Exec", NULL );
+			g_autofree char *try_exec = g_key_file_get_string ( key_file, "Thumbnailer Entry", "TryExec", NULL );
+			g_autofree char *program = ( try_exec ) ? g_find_program_in_path ( try_exec ) : NULL;
+
+			char **mimes = ( exec && ( !try_exec || program ) ) ? g_key_file_get_string_list ( key_file, "Thumbnailer Entry", "MimeType", NULL, NULL ) : NULL;
+
+			uint i = 0; for ( i = 0; mimes && mimes[i]; i++ )
+				if ( *mimes[i] && !g_hash_table_contains ( thumbnailers, mimes[i] ) ) g_hash_table_insert ( thumbnailers, g_strdup ( mimes[i] ), g_strdup ( exec ) );
+
+			if ( mimes ) g_strfreev ( mimes );
+		}
+
+		g_key_file_free ( key_file );
+	}
+
+	g_dir_close ( dir );
+}
+
+// Lock held
+static void gmf_thumbnailer_init ( void )
+{
+	if ( thumbnailers ) return;
+
+	thumbnailers = g_hash_table_new_full ( g_str_hash, g_str_equal, free, free );
+
+	gmf_thumbnailer_load_dir ( g_get_user_data_dir () );
+
+	const char * const *dirs = g_get_system_data_dirs ();
+
+	uint i = 0; for ( i = 0; dirs[i]; i++ ) gmf_thumbnailer_load_dir ( dirs[i] );
+}
+
+// Images stay with gdk-pixbuf in the process: only what it cannot preview goes out
+gboolean gmf_thumbnailer_supports ( const char *content_type )
+{
+	if ( !content_type || g_str_has_prefix ( content_type, "image" ) ) return FALSE;
+
+	G_LOCK ( thumbnailers );
+
+	gmf_thumbnailer_init ();
+
+	gboolean ret = g_hash_table_contains ( thumbnailers, content_type );
+
+	G_UNLOCK ( thumbnailers );
+
+	return ret;
+}
+
+// %s size, %u URI, %i input path, %o output path, %% a percent sign; expanded inside each argument
+static char ** gmf_thumbnailer_argv ( const char *exec, const char *path, int size, const char *out )
+{
+	char **argv = NULL;
+
+	if ( !g_shell_parse_argv ( exec, NULL, &argv, NULL ) ) return NULL;
+
+	g_autofree char *uri = g_filename_to_uri ( path, NULL, NULL );
+
+	uint i = 0; for ( i = 0; argv[i]; i++ )
+	{
+		GString *arg = g_string_new ( NULL );
+
+		const char *p = NULL; for ( p = argv[i]; *p; p++ )
+		{
+			if ( *p != '%' || !p[1] ) { g_string_append_c ( arg, *p ); continue; }
+
+			switch ( *++p )
+			{
+				case 's': g_string_append_printf ( arg, "%d", size ); break;
+				case 'u': g_string_append ( arg, ( uri ) ? uri : "" ); break;
+				case 'i': g_string_append ( arg, path ); break;
+				case 'o': g_string_append ( arg, out ); break;
+				case '%': g_string_append_c ( arg, '%' ); break;
+
+				default: break;
+			}
+		}
+
+		free ( argv[i] );
+		argv[i] = g_string_free ( arg, FALSE );
+	}
+
+	return argv;
+}
+
+// In the child, before exec: only async-signal-safe calls
+static void gmf_thumbnailer_child_setup ( G_GNUC_UNUSED gpointer data )
+{
+	struct rlimit mem = { THUMBNAILER_MEMORY, THUMBNAILER_MEMORY };
+	struct rlimit cpu = { THUMBNAILER_TIMEOUT, THUMBNAILER_TIMEOUT + 1 };
+
+	// A group of its own, so a timeout also kills whatever the thumbnailer started
+	setpgid ( 0, 0 );
+
+	setrlimit ( RLIMIT_AS,  &mem );
+	setrlimit ( RLIMIT_CPU, &cpu );
+
+	setpriority ( PRIO_PROCESS, 0, 10 );
+}
+
+static uint8_t gmf_thumbnailer_spawn ( char **argv, const int *cancel )
+{
+	GPid pid = 0;
+
+	GSpawnFlags flags = G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_STDOUT_TO_DEV_NULL | G_SPAWN_STDERR_TO_DEV_NULL;
+
+	if ( !g_spawn_async ( NULL, argv, NULL, flags, gmf_thumbnailer_child_setup, NULL, &pid, NULL ) ) return GMF_THUMBNAILER_FAILED;
+
+	int status = 0;
+	pid_t ret = 0;
+
+	int64_t end = g_get_monotonic_time () + THUMBNAILER_TIMEOUT * G_USEC_PER_SEC;
+
+	gboolean cancelled = FALSE;
+
+	while ( ( ret = waitpid ( pid, &status, WNOHANG ) ) == 0 && g_get_monotonic_time () < end && !( cancelled = g_atomic_int_get ( (int *)cancel ) ) )
+		g_usleep ( THUMBNAILER_POLL );
+
+	// Hung or no longer wanted
+	if ( ret == 0 ) { kill ( -pid, SIGKILL ); kill ( pid, SIGKILL ); waitpid ( pid, &status, 0 ); }
+
+	g_spawn_close_pid ( pid );
+
+	if ( cancelled ) return GMF_THUMBNAILER_CANCELLED;
+
+	return ( ret == pid && WIFEXITED ( status ) && WEXITSTATUS ( status ) == 0 ) ? GMF_THUMBNAILER_DONE : GMF_THUMBNAILER_FAILED;
+}
+
+static void gmf_thumbnailer_task ( ThumbnailerTask *task, G_GNUC_UNUSED gpointer data )
+{
+	uint8_t ret = ( g_atomic_int_get ( (int *)task->cancel ) ) ? GMF_THUMBNAILER_CANCELLED : gmf_thumbnailer_spawn ( task->argv, task->cancel );
+
+	task->func ( ret, task->data );
+
+	g_strfreev ( task->argv );
+	free ( task );
+}
+
+/* Makes a thumbnail of path, size pixels at most, in the PNG file out, in a child process.
+ * Queued behind at most THUMBNAILER_MAX running children; func gets the outcome on a runner
+ * thread, exactly once. The UI and the thumbnail workers never wait for a child. */
+void gmf_thumbnailer_run ( const char *path, const char *content_type, int size, const char *out, const int *cancel, GmfThumbnailerFunc func, gpointer data )
+{
+	G_LOCK ( thumbnailers );
+
+	gmf_thumbnailer_init ();
+
+	const char *exec = ( content_type ) ? g_hash_table_lookup ( thumbnailers, content_type ) : NULL;
+
+	char **argv = ( exec ) ? gmf_thumbnailer_argv ( exec, path, size, out ) : NULL;
+
+	if ( argv && !runners ) runners = g_thread_pool_new ( (GFunc)gmf_thumbnailer_task, NULL, THUMBNAILER_MAX, FALSE, NULL );
+
+	G_UNLOCK ( thumbnailers );
+
+	if ( !argv ) { func ( GMF_THUMBNAILER_FAILED, data ); return; }
+
+	ThumbnailerTask *task = g_new0 ( ThumbnailerTask, 1 );
+
+	task->argv = argv;
+	task->cancel = cancel;
+	task->func = func;
+	task->data = data;
+
+	g_thread_pool_push ( runners, task, NULL );
+}
@@ -0,0 +1,25 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#pragma once
+
+#include <gtk/gtk.h>
+
+enum gmf_thumbnailer_enm
+{
+	GMF_THUMBNAILER_DONE,
+	GMF_THUMBNAILER_FAILED,
+	GMF_THUMBNAILER_CANCELLED
+};
+
+typedef void ( *GmfThumbnailerFunc ) ( uint8_t, gpointer );
+
+gboolean gmf_thumbnailer_supports ( const char * );
+
+void gmf_thumbnailer_run ( const char *, const char *, int, const char *, const int *, GmfThumbnailerFunc, gpointer );
@@ -8,33 +8,41 @@
 */
 
 #include "gmf-win.h"
+#include "gmf-dir-cache.h"
+#include "gmf-dir-model.h"
+#include "gmf-pool.h"
+#include "gmf-pixbuf-cache.h"
+#include "gmf-thumb.h"
+#include "gmf-thumb-store.h"
+#include "gmf-thumbnailer.h"
+#include "gmf-mime.h"
 #include "gmf-dialog.h"
 #include "gmf-info-win.h"
 
-#include <errno.h>
 #include <glib/gstdio.h>
 
 #define MAX_TAB 8
 #define ITEM_WIDTH 80
 #define UNUSED G_GNUC_UNUSED
 
-G_LOCK_DEFINE_STATIC ( done_th );
+#define LOAD_TICK     10    // ms
+#define LOAD_BATCH    512
+#define LOAD_FLUSH    5000  // us
+#define LOAD_BUDGET   8000  // us
+#define LOAD_VIEW_MAX 1000
+#define REFRESH_MAX 1000
+
+#define THUMB_TICK 16
+#define THUMB_BUDGET 6000
+#define SCROLL_STOP 150
+
+#define THUMB_IO_BATCH 16
+#define THUMB_IO_BYTES ( 32 << 20 )
+
 G_LOCK_DEFINE_STATIC ( copy_th );
 
 typedef unsigned int uint;
 
-enum cols_enm
-{
-	COL_PATH,
-	COL_NAME,
-	COL_IS_DIR,
-	COL_IS_LINK,
-	COL_IS_PIXBUF,
-	COL_PIXBUF,
-	COL_SIZE,
-	NUM_COLS
-};
-
 enum copy_cut_enm
 {
 	COPY,
@@ -48,14 +56,6 @@ enum act_enm
 	ACT_EDT
 };
 
-enum sort_enm 
-{
-	SORT_AZ,
-	SORT_ZA,
-	SORT_MG,
-	SORT_GM
-};
-
 enum bt_enm 
 {
 	BT_WIN,
@@ -125,6 +125,154 @@ const char *bpb_icon_n[BTP_BAL] =
 	[BTP_RUN] = "system-run"
 };
 
+typedef struct _DirLoad DirLoad;
+
+struct _DirLoad
+{
+	int ref;
+	int done;
+
+	char *path;
+	char *search;
+	char *error;
+
+	int *order;
+	GmfDirList *list;
+
+	gboolean cache;
+	gboolean hidden;
+	gboolean refresh;
+	uint16_t first;
+	enum sort_enm sort;
+
+	GAsyncQueue *queue;
+	GCancellable *cancellable;
+
+	// Main thread only; the window is not kept alive by its load
+
+	uint gen;
+	GWeakRef win;
+
+	uint nums;
+	uint indx;
+	GPtrArray *batch;
+
+	GdkPixbuf *pixbuf_dir;
+	GdkPixbuf *pixbuf_file;
+};
+
+typedef struct _IconFile IconFile;
+
+// A file as its listing stat'ed it: finding its icon takes no further stat
+struct _IconFile
+{
+	const char *path;
+
+	// icon_size, scale and is_link always; the file's identity only with has_key
+	GmfPixbufKey key;
+	gboolean has_key;
+
+	gboolean is_dir;
+	gboolean is_regular;
+
+	// Sniffed once it is known, interned: whoever needs it next does not open the file again
+	const char *content_type;
+};
+
+typedef struct _ThumbItem ThumbItem;
+
+struct _ThumbItem
+{
+	char *name;
+	uint row;
+
+	// As the listing stat'ed it, path aside
+	IconFile file;
+
+	// Read by the I/O stage, taken by the decode task; tier instead when a bigger thumbnail is in memory
+	GmfThumbData *data;
+	GdkPixbuf *tier;
+};
+
+typedef struct _ThumbResult ThumbResult;
+
+struct _ThumbResult
+{
+	ThumbResult *next;
+
+	uint indx;
+	gboolean final;
+	GdkPixbuf *pixbuf;
+};
+
+typedef struct _ThumbJob ThumbJob;
+
+/* Thumbnails for the shown model, in two stages. The job's I/O thread claims rows by distance
+ * from the viewport, so whatever is on screen comes first, then one screen ahead in the scroll
+ * direction, then outward; it reads a batch of image files in inode order into memory and queues
+ * one pool task per row. The pool bounds the decoding, the I/O thread stops reading while too many
+ * bytes or tasks wait for it. Tasks push onto the lock-free done stack; the main loop moves the
+ * results into the model. Every task and the I/O thread hold a reference. Once the window's memory
+ * ceiling is reached, nothing beyond one screen on either side is claimed. While the view scrolls,
+ * images only get a cheap preview, made by the task itself; they are claimed again when it stops. */
+struct _ThumbJob
+{
+	int ref;
+	int left;
+	int cancel;
+
+	char *dir;
+	uint16_t icon_size;
+	uint8_t scale;
+
+	uint n_items;
+	ThumbItem *items;
+
+	ThumbResult *done;
+
+	int over;
+	int requeue;
+	int scrolling;
+
+	// Claim cursors, guarded by the mutex
+
+	GMutex mutex;
+	uint8_t *claimed;
+
+	uint vis;
+	uint vis_end;
+	uint margin;
+
+	int keep_lo;
+	int keep_hi;
+
+	int ahead;
+	int behind;
+	int step;
+	gboolean turn;
+
+	// I/O stage, guarded by the mutex: what is read or queued and not yet decoded
+
+	GCond cond;
+	size_t io_bytes;
+	uint io_tasks;
+
+	gboolean io_run;
+	gboolean io_again;
+
+	// Main thread only; the window is not kept alive by its job
+
+	uint gen;
+	GWeakRef win;
+
+	GtkTreeModel *model;
+
+	double scroll;
+
+	ThumbResult *ready;
+	ThumbResult *ready_tail;
+};
+
 struct _GmfWin
 {
 	GtkWindow parent_instance;
@@ -163,22 +311,23 @@ struct _GmfWin
 	uint8_t opacity;
 	uint16_t icon_size;
 
+	// The icon view's scale factor: pixbufs are icon_size x scale pixels
+	uint8_t scale;
+
 	gboolean dark;
 	gboolean hidden;
 	gboolean preview;
 	gboolean unmount_set_home;
 
-	GtkTreeModel *model_t;
+	uint gen;
+	uint open_id;
+	uint scroll_id;
 
-	uint8_t   mod_t;
-	uint8_t limit_t;
-	uint64_t  end_t;
+	DirLoad *load;
+	ThumbJob *thumb;
+	GtkTreeModel *model_t;
 
-	gboolean break_t;
-	gboolean done_t_0;
-	gboolean done_t_1;
-	gboolean done_t_2;
-	gboolean done_t_3;
+	uint thumb_mb;
 
 	enum sort_enm sort_num;
 
@@ -218,8 +367,10 @@ typedef void ( *fp ) ( GmfWin * );
 
 static void gmf_win_icon_press_act ( GmfWin * );
 static void gmf_win_icon_open_dir_tm ( GmfWin *win );
+static void gmf_icon_update_pixbuf_all ( GtkTreeModel *, GmfWin * );
+static void gmf_win_icon_refresh ( const char *, GmfWin * );
 static void gmf_win_set_file ( const char *, GmfWin * );
-static GtkTreeModel * gmf_win_icon_create_model ( GmfWin * );
+static GtkTreeModel * gmf_win_icon_create_model ( const char *, GmfWin * );
 
 // ***** Copy *****
 
@@ -795,7 +946,20 @@ static void gmf_win_srh ( GmfWin *win )
 
 static void gmf_win_rld ( GmfWin *win )
 {
-	gmf_win_icon_open_dir_tm ( win );
+	g_autofree char *path = g_file_get_path ( win->file );
+
+	if ( !path ) return;
+
+	// An explicit reload always goes back to the disk
+	gmf_dir_cache_invalidate ( path );
+
+	GtkTreeModel *model = gtk_icon_view_get_model ( win->icon_view );
+
+	// Only a complete, unfiltered listing of this directory can be brought up to date in place
+	gboolean diff = ( !win->load && !win->model_t && !gtk_widget_is_visible ( GTK_WIDGET ( win->entry_search ) ) 
+		&& g_str_equal ( path, gmf_dir_model_get_dir ( GMF_DIR_MODEL ( model ) ) ) );
+
+	if ( diff ) gmf_win_icon_refresh ( path, win ); else gmf_win_icon_open_dir_tm ( win );
 }
 
 static void gmf_win_inf ( GmfWin *win )
@@ -1515,78 +1679,222 @@ static GtkPopover * gmf_win_pp_tab ( GmfWin *win )
 
 // ***** Icon-View *****
 
+G_LOCK_DEFINE_STATIC ( icon_memo );
+
+// Emblems are immutable: one per name for the whole process
+static GHashTable *icon_emblems = NULL;
+
+// Theme icons by "gicon|link|broken|dir|size": thousands of files share a handful of pixbufs
+static GHashTable *icon_memo = NULL;
+
+typedef struct _LauncherIcon LauncherIcon;
+
+struct _LauncherIcon
+{
+	int64_t mtime;
+	char *icon;
+
+	// The icon of the last size and scale asked for
+	GdkPixbuf *pixbuf;
+	uint16_t icon_size;
+	uint8_t scale;
+};
+
+// .desktop files by path: the parsed Icon key and its pixbuf, good while the file keeps its mtime
+static GHashTable *launcher_icons = NULL;
+
+static GEmblem * gmf_win_emblem_get ( const char *name )
+{
+	G_LOCK ( icon_memo );
+
+	if ( !icon_emblems ) icon_emblems = g_hash_table_new_full ( g_str_hash, g_str_equal, free, g_object_unref );
+
+	GEmblem *emblem = g_hash_table_lookup ( icon_emblems, name );
+
+	if ( !emblem )
+	{
+		GIcon *e_icon = g_themed_icon_new ( name );
+		emblem = g_emblem_new ( e_icon );
+		g_object_unref ( e_icon );
+
+		g_hash_table_insert ( icon_emblems, g_strdup ( name ), emblem );
+	}
+
+	g_object_ref ( emblem );
+
+	G_UNLOCK ( icon_memo );
+
+	return emblem;
+}
+
 static inline GIcon * gmf_win_emblemed_icon ( const char *name_1, const char *name_2, GIcon *gicon )
 {
-	GIcon *e_icon = g_themed_icon_new ( name_1 );
-	GEmblem *emblem  = g_emblem_new ( e_icon );
+	GEmblem *emblem = gmf_win_emblem_get ( name_1 );
 
 	GIcon *emblemed  = g_emblemed_icon_new ( gicon, emblem );
 
 	if ( name_2 )
 	{
-		GIcon *e_icon_2 = g_themed_icon_new ( name_2 );
-		GEmblem *emblem_2  = g_emblem_new ( e_icon_2 );
+		GEmblem *emblem_2 = gmf_win_emblem_get ( name_2 );
 
 		g_emblemed_icon_add_emblem ( G_EMBLEMED_ICON ( emblemed ), emblem_2 );
 
-		g_object_unref ( e_icon_2 );
 		g_object_unref ( emblem_2 );
 	}
 
-	g_object_unref ( e_icon );
 	g_object_unref ( emblem );
 
 	return emblemed;
 }
 
-static inline GdkPixbuf * gmf_win_desktop_app_get_pixbuf ( const char *path, uint16_t icon_size )
+static GdkPixbuf * gmf_win_icon_memo_lookup ( const char *key )
+{
+	G_LOCK ( icon_memo );
+
+	GdkPixbuf *pixbuf = ( icon_memo ) ? g_hash_table_lookup ( icon_memo, key ) : NULL;
+
+	if ( pixbuf ) g_object_ref ( pixbuf );
+
+	G_UNLOCK ( icon_memo );
+
+	return pixbuf;
+}
+
+static void gmf_win_icon_memo_insert ( const char *key, GdkPixbuf *pixbuf )
+{
+	G_LOCK ( icon_memo );
+
+	if ( !icon_memo ) icon_memo = g_hash_table_new_full ( g_str_hash, g_str_equal, free, g_object_unref );
+
+	g_hash_table_replace ( icon_memo, g_strdup ( key ), g_object_ref ( pixbuf ) );
+
+	G_UNLOCK ( icon_memo );
+}
+
+// Theme lookups go stale with the icon theme
+static void gmf_win_icon_memo_clear ( void )
+{
+	G_LOCK ( icon_memo );
+
+	if ( icon_memo ) g_hash_table_remove_all ( icon_memo );
+	if ( launcher_icons ) g_hash_table_remove_all ( launcher_icons );
+
+	G_UNLOCK ( icon_memo );
+}
+
+static void gmf_win_launcher_icon_free ( LauncherIcon *launcher )
+{
+	if ( launcher->pixbuf ) g_object_unref ( launcher->pixbuf );
+
+	free ( launcher->icon );
+	free ( launcher );
+}
+
+// From the folder monitor: the launcher was edited, replaced or removed
+static void gmf_win_launcher_icon_forget ( GFile *file )
+{
+	g_autofree char *path = ( file ) ? g_file_get_path ( file ) : NULL;
+
+	if ( !path || !g_str_has_suffix ( path, ".desktop" ) ) return;
+
+	G_LOCK ( icon_memo );
+
+	if ( launcher_icons ) g_hash_table_remove ( launcher_icons, path );
+
+	G_UNLOCK ( icon_memo );
+}
+
+/* A launcher's icon: the file is parsed once and the theme looked up once per size, not on every visit
+ * to a folder of launchers. The listing's mtime catches changes the monitor did not see. */
+static inline GdkPixbuf * gmf_win_desktop_app_get_pixbuf ( const char *path, uint16_t icon_size, uint8_t scale, int64_t mtime )
 {
 	GdkPixbuf *pixbuf = NULL;
+	g_autofree char *icon = NULL;
+	gboolean parsed = FALSE;
 
-	GDesktopAppInfo *d_app = g_desktop_app_info_new_from_filename ( path );
+	G_LOCK ( icon_memo );
 
-	g_autofree char *icon = ( d_app ) ? g_desktop_app_info_get_string ( d_app, "Icon" ) : NULL;
+	LauncherIcon *launcher = ( launcher_icons ) ? g_hash_table_lookup ( launcher_icons, path ) : NULL;
 
-	if ( icon ) pixbuf = gtk_icon_theme_load_icon ( gtk_icon_theme_get_default (), icon, icon_size, GTK_ICON_LOOKUP_FORCE_REGULAR, NULL );
+	if ( launcher && launcher->mtime == mtime )
+	{
+		parsed = TRUE;
+		icon = g_strdup ( launcher->icon );
+
+		if ( launcher->pixbuf && launcher->icon_size == icon_size && launcher->scale == scale ) pixbuf = g_object_ref ( launcher->pixbuf );
+	}
+
+	G_UNLOCK ( icon_memo );
+
+	if ( pixbuf || ( parsed && !icon ) ) return pixbuf;
+
+	if ( !parsed )
+	{
+		GDesktopAppInfo *d_app = g_desktop_app_info_new_from_filename ( path );
+
+		icon = ( d_app ) ? g_desktop_app_info_get_string ( d_app, "Icon" ) : NULL;
+
+		if ( d_app ) g_object_unref ( d_app );
+	}
+
+	if ( icon ) pixbuf = gtk_icon_theme_load_icon_for_scale ( gtk_icon_theme_get_default (), icon, icon_size, scale, GTK_ICON_LOOKUP_FORCE_REGULAR, NULL );
+
+	if ( pixbuf ) gmf_pixbuf_mark_shared ( pixbuf );
+
+	launcher = g_new0 ( LauncherIcon, 1 );
+
+	launcher->mtime = mtime;
+	launcher->icon = g_strdup ( icon );
+	launcher->pixbuf = ( pixbuf ) ? g_object_ref ( pixbuf ) : NULL;
+	launcher->icon_size = icon_size;
+	launcher->scale = scale;
+
+	G_LOCK ( icon_memo );
+
+	if ( !launcher_icons ) launcher_icons = g_hash_table_new_full ( g_str_hash, g_str_equal, free, (GDestroyNotify)gmf_win_launcher_icon_free );
 
-	if ( d_app ) g_object_unref ( d_app );
+	g_hash_table_replace ( launcher_icons, g_strdup ( path ), launcher );
+
+	G_UNLOCK ( icon_memo );
 
 	return pixbuf;
 }
 
-static inline GdkPixbuf * gmf_win_image_get_pixbuf ( const char *path, gboolean is_link, uint16_t icon_size, GFile *file )
+static inline GdkPixbuf * gmf_win_image_get_pixbuf ( const char *path, gboolean is_link, uint16_t icon_size, uint8_t scale )
 {
 	GdkPixbuf *pixbuf = NULL;
 
 	if ( is_link )
 	{
+		GFile *file = g_file_new_for_path ( path );
 		GIcon *gicon = g_file_icon_new ( file ), *emblemed = gmf_win_emblemed_icon ( "emblem-symbolic-link", NULL, gicon );
-		GtkIconInfo *icon_info = gtk_icon_theme_lookup_by_gicon ( gtk_icon_theme_get_default (), emblemed, icon_size, GTK_ICON_LOOKUP_FORCE_SIZE );
+		GtkIconInfo *icon_info = gtk_icon_theme_lookup_by_gicon_for_scale ( gtk_icon_theme_get_default (), emblemed, icon_size, scale, GTK_ICON_LOOKUP_FORCE_SIZE );
 
 		if ( icon_info ) pixbuf = gtk_icon_info_load_icon ( icon_info, NULL );
 
+		if ( file ) g_object_unref ( file );
 		if ( gicon ) g_object_unref ( gicon );
 		if ( emblemed ) g_object_unref ( emblemed );
 		if ( icon_info ) g_object_unref ( icon_info );
 	}
 	else
-		pixbuf = gdk_pixbuf_new_from_file_at_size ( path, icon_size, icon_size, NULL );
+		pixbuf = gmf_thumb_get ( path, (uint16_t)( icon_size * scale ) );
 
 	return pixbuf;
 }
 
-static inline GtkIconInfo * gmf_win_get_icon_info ( const char *content_type, gboolean is_link, uint16_t icon_size, GFileInfo *finfo )
+static inline GtkIconInfo * gmf_win_get_icon_info ( const char *content_type, gboolean is_link, uint16_t icon_size, uint8_t scale, GIcon *gicon )
 {
 	GtkIconInfo *icon_info = NULL;
 
 	GtkIconTheme *icon_theme = gtk_icon_theme_get_default ();
-	GIcon *unknown = NULL, *emblemed = NULL, *gicon = g_file_info_get_icon ( finfo );
+	GIcon *unknown = NULL, *emblemed = NULL;
 
 	if ( gicon )
 	{
 		if ( is_link ) emblemed = gmf_win_emblemed_icon ( "emblem-symbolic-link", NULL, gicon );
 
-		icon_info = gtk_icon_theme_lookup_by_gicon ( icon_theme, ( is_link ) ? emblemed : gicon, icon_size, GTK_ICON_LOOKUP_FORCE_REGULAR );
+		icon_info = gtk_icon_theme_lookup_by_gicon_for_scale ( icon_theme, ( is_link ) ? emblemed : gicon, icon_size, scale, GTK_ICON_LOOKUP_FORCE_REGULAR );
 	}
 
 	if ( !icon_info && is_link )
@@ -1600,7 +1908,7 @@ static inline GtkIconInfo * gmf_win_get_icon_info ( const char *content_type, gb
 		else
 			emblemed = gmf_win_emblemed_icon ( "emblem-symbolic-link", NULL, unknown );
 
-		icon_info = gtk_icon_theme_lookup_by_gicon ( icon_theme, emblemed, icon_size, GTK_ICON_LOOKUP_FORCE_REGULAR );
+		icon_info = gtk_icon_theme_lookup_by_gicon_for_scale ( icon_theme, emblemed, icon_size, scale, GTK_ICON_LOOKUP_FORCE_REGULAR );
 	}
 
 	if ( unknown ) g_object_unref ( unknown );
@@ -1609,340 +1917,1481 @@ static inline GtkIconInfo * gmf_win_get_icon_info ( const char *content_type, gb
 	return icon_info;
 }
 
-static GdkPixbuf * gmf_win_icon_get_pixbuf ( const char *path, gboolean is_link, uint16_t icon_size )
+static GdkPixbuf * gmf_win_icon_theme_get_pixbuf ( const char *content_type, gboolean is_link, gboolean is_dir, uint16_t icon_size, uint8_t scale, GIcon *gicon )
 {
-	GdkPixbuf *pixbuf = NULL;
-
-	GFile *file = g_file_new_for_path ( path );
-	GFileInfo *finfo = g_file_query_info ( file, "*", 0, NULL, NULL );
+	gboolean broken = ( is_link && content_type && g_str_has_prefix ( content_type, "inode/symlink" ) );
 
-	gboolean is_dir = g_file_test ( path, G_FILE_TEST_IS_DIR );
-	const char *content_type = ( finfo ) ? g_file_info_get_content_type ( finfo ) : NULL;
+	g_autofree char *name = ( gicon ) ? g_icon_to_string ( gicon ) : NULL;
+	g_autofree char *key  = g_strdup_printf ( "%s|%d|%d|%d|%u|%u", ( name ) ? name : "", is_link, broken, is_dir, icon_size, scale );
 
-	if ( content_type && g_str_has_prefix ( content_type, "image" ) ) pixbuf = gmf_win_image_get_pixbuf ( path, is_link, icon_size, file );
+	GdkPixbuf *pixbuf = gmf_win_icon_memo_lookup ( key );
 
-	if ( !pixbuf && !is_dir && content_type && g_str_equal ( content_type, "application/x-desktop" ) ) pixbuf = gmf_win_desktop_app_get_pixbuf ( path, icon_size );
+	if ( pixbuf ) return pixbuf;
 
-	if ( finfo && !pixbuf )
+	if ( content_type || gicon )
 	{
-		GtkIconInfo *icon_info = gmf_win_get_icon_info ( content_type, is_link, icon_size, finfo );
+		GtkIconInfo *icon_info = gmf_win_get_icon_info ( content_type, is_link, icon_size, scale, gicon );
 
 		if ( icon_info ) pixbuf = gtk_icon_info_load_icon ( icon_info, NULL );
 
 		if ( icon_info ) g_object_unref ( icon_info );
 	}
 
-	if ( finfo ) g_object_unref ( finfo );
-	if ( file  ) g_object_unref ( file  );
+	if ( !pixbuf ) pixbuf = gtk_icon_theme_load_icon_for_scale ( gtk_icon_theme_get_default (), ( is_dir ) ? "folder" : "unknown", icon_size, scale, GTK_ICON_LOOKUP_FORCE_REGULAR, NULL );
 
-	if ( !pixbuf ) pixbuf = gtk_icon_theme_load_icon ( gtk_icon_theme_get_default (), ( is_dir ) ? "folder" : "unknown", icon_size, GTK_ICON_LOOKUP_FORCE_REGULAR, NULL );
+	if ( pixbuf ) { gmf_pixbuf_mark_shared ( pixbuf ); gmf_win_icon_memo_insert ( key, pixbuf ); }
 
 	return pixbuf;
 }
 
-static void gmf_icon_set_pixbuf ( uint16_t icon_size, GtkTreeIter iter, GtkTreeModel *model )
+// The stand-in of every row that has no pixbuf of its own yet, or none at all without previews
+static GdkPixbuf * gmf_win_icon_placeholder ( gboolean is_dir, GmfWin *win )
 {
-	gboolean is_link = FALSE;
-	g_autofree char *path = NULL;
-	gtk_tree_model_get ( model, &iter, COL_PATH, &path, COL_IS_LINK, &is_link, -1 );
+	GdkPixbuf *pixbuf = gtk_icon_theme_load_icon_for_scale ( gtk_icon_theme_get_default (), ( is_dir ) ? "folder" : "text-x-preview", win->icon_size, win->scale, GTK_ICON_LOOKUP_FORCE_REGULAR, NULL );
 
-	if ( g_file_test ( path, G_FILE_TEST_EXISTS ) )
-	{
-		GdkPixbuf *pixbuf = gmf_win_icon_get_pixbuf ( path, is_link, icon_size );
+	if ( pixbuf ) gmf_pixbuf_mark_shared ( pixbuf );
 
-		if ( pixbuf ) gtk_list_store_set ( GTK_LIST_STORE ( model ), &iter, COL_IS_PIXBUF, TRUE, COL_PIXBUF, pixbuf, -1 );
+	return pixbuf;
+}
 
-		if ( pixbuf ) g_object_unref ( pixbuf );
-	}
+static void gmf_win_icon_file_init_entry ( const char *path, const GmfDirEntry *entry, uint16_t icon_size, uint8_t scale, IconFile *file )
+{
+	file->path = path;
+	file->has_key = gmf_pixbuf_key_init_entry ( entry, icon_size, scale, &file->key );
+	file->is_dir = entry->is_dir;
+	file->is_regular = entry->is_regular;
+	file->content_type = NULL;
 }
 
-static gpointer gmf_icon_update_pixbuf_thread ( GmfWin *win )
+// No path: the thumbnail job builds it when the row's turn comes
+static void gmf_win_icon_file_init_row ( GtkTreeModel *model, GtkTreeIter *iter, uint16_t icon_size, uint8_t scale, IconFile *file )
 {
-	GtkTreeModel *model = win->model_t;
+	gboolean is_dir = FALSE;
+	gtk_tree_model_get ( model, iter, COL_IS_DIR, &is_dir, -1 );
 
-	gboolean break_t = FALSE;
-	uint64_t num = 0, end = win->end_t;
-	uint16_t icon_size = win->icon_size;
-	uint8_t mod = win->mod_t, limit = win->limit_t;
+	file->path = NULL;
+	file->has_key = gmf_dir_model_get_key ( GMF_DIR_MODEL ( model ), iter, icon_size, scale, &file->key );
+	file->is_dir = is_dir;
+	file->is_regular = gmf_dir_model_is_regular ( GMF_DIR_MODEL ( model ), iter );
+	file->content_type = NULL;
+}
 
-	GtkTreeIter iter;
-	gboolean valid = FALSE;
+// The one type every stage goes by: sniffed as GIO would, only for a regular file, which is safe to open
+static const char * gmf_win_icon_file_type ( const IconFile *file )
+{
+	if ( file->content_type || !file->is_regular || !file->has_key ) return file->content_type;
 
-	for ( valid = gtk_tree_model_get_iter_first ( model, &iter ); valid; valid = gtk_tree_model_iter_next ( model, &iter ) )
-	{
-		G_LOCK ( done_th );
-			if ( win->break_t ) break_t = TRUE;
-		G_UNLOCK ( done_th );
+	return gmf_mime_get_content_type ( file->path );
+}
 
-		if ( break_t ) return NULL;
+// thumb: an image is decoded to its thumbnail, else it only gets its MIME icon
+static GdkPixbuf * gmf_win_icon_load_pixbuf ( const IconFile *file, gboolean thumb )
+{
+	GdkPixbuf *pixbuf = NULL;
+	GFileInfo *finfo = NULL;
+	GIcon *gicon = NULL;
 
-		if ( ( !limit && num > end ) || ( limit && num < end ) ) { num++; continue; }
+	const GmfPixbufKey *key = &file->key;
+	const char *content_type = NULL;
 
-		if (  mod && !( num % 2 ) ) { num++; continue; }
-		if ( !mod &&  ( num % 2 ) ) { num++; continue; }
+	// A regular file is sniffed here, as gmf_mime_query_info would, without GIO stat'ing it once more
+	if ( file->is_regular && file->has_key )
+	{
+		content_type = gmf_win_icon_file_type ( file );
+		gicon = g_content_type_get_icon ( content_type );
+	}
+	else
+	{
+		GFile *gfile = g_file_new_for_path ( file->path );
 
-		gboolean is_pb = FALSE;
-		gtk_tree_model_get ( model, &iter, COL_IS_PIXBUF, &is_pb, -1 );
+		finfo = g_file_query_info ( gfile, G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE "," G_FILE_ATTRIBUTE_STANDARD_ICON, 0, NULL, NULL );
 
-		if ( !is_pb ) gmf_icon_set_pixbuf ( icon_size, iter, model );
+		content_type = ( finfo ) ? g_file_info_get_content_type ( finfo ) : NULL;
+		gicon = ( finfo && g_file_info_get_icon ( finfo ) ) ? g_object_ref ( g_file_info_get_icon ( finfo ) ) : NULL;
 
-		num++;
+		g_object_unref ( gfile );
 	}
 
-	G_LOCK ( done_th );
+	if ( thumb && content_type && g_str_has_prefix ( content_type, "image" ) ) pixbuf = gmf_win_image_get_pixbuf ( file->path, key->is_link, key->icon_size, key->scale );
 
-	if ( !mod && !limit ) win->done_t_0 = TRUE;
-	if (  mod && !limit ) win->done_t_1 = TRUE;
-	if ( !mod &&  limit ) win->done_t_2 = TRUE;
-	if (  mod &&  limit ) win->done_t_3 = TRUE;
+	if ( !pixbuf && file->is_regular && file->has_key && content_type && g_str_equal ( content_type, "application/x-desktop" ) )
+		pixbuf = gmf_win_desktop_app_get_pixbuf ( file->path, key->icon_size, key->scale, key->mtime );
 
-	G_UNLOCK ( done_th );
+	if ( !pixbuf ) pixbuf = gmf_win_icon_theme_get_pixbuf ( content_type, key->is_link, file->is_dir, key->icon_size, key->scale, gicon );
 
-	return NULL;
+	if ( gicon ) g_object_unref ( gicon );
+	if ( finfo ) g_object_unref ( finfo );
+
+	return pixbuf;
 }
 
-static gboolean gmf_win_icon_update_pixbuf_timeout ( GmfWin *win )
+// Thread safe: called from the pool workers as well as the main thread
+static GdkPixbuf * gmf_win_icon_get_pixbuf ( const IconFile *file )
 {
-	if ( !GTK_IS_WIDGET ( win->icon_view ) ) return FALSE;
+	GdkPixbuf *pixbuf = ( file->has_key ) ? gmf_pixbuf_cache_lookup ( &file->key ) : NULL;
 
-	if ( win->break_t ) { g_usleep ( 100000 ); g_object_unref ( win->model_t ); win->model_t = NULL; return FALSE; }
+	if ( pixbuf ) return pixbuf;
 
-	if ( win->done_t_0 && win->done_t_1 && win->done_t_2 && win->done_t_3 )
-	{
-		GtkTreeModel *model_old = gtk_icon_view_get_model ( win->icon_view );
+	pixbuf = gmf_win_icon_load_pixbuf ( file, TRUE );
+
+	if ( pixbuf && file->has_key ) gmf_pixbuf_cache_insert ( &file->key, pixbuf );
 
-		gtk_list_store_clear ( GTK_LIST_STORE ( model_old ) );
+	return pixbuf;
+}
 
-		gtk_icon_view_set_model ( win->icon_view, win->model_t );
+// This process's cache first, then the store every gmf process shares: a thumbnail another window decoded is not decoded again
+static GdkPixbuf * gmf_win_icon_lookup ( const GmfPixbufKey *key )
+{
+	GdkPixbuf *pixbuf = gmf_pixbuf_cache_lookup ( key );
 
-		g_object_unref ( win->model_t );
-		win->model_t = NULL;
+	if ( pixbuf ) return pixbuf;
 
-		return FALSE;
-	}
+	pixbuf = gmf_thumb_store_lookup ( key );
 
-	return TRUE;
+	if ( pixbuf ) { gmf_pixbuf_cache_insert ( key, pixbuf ); gmf_pixbuf_cache_insert_tier ( key, pixbuf ); }
+
+	return pixbuf;
 }
 
-static void gmf_icon_update_pixbuf_all ( uint nums, GmfWin *win )
+// A real thumbnail, not a MIME icon: shared with the other processes, and kept for smaller icon sizes
+static void gmf_win_icon_keep_thumb ( const GmfPixbufKey *key, GdkPixbuf *pixbuf )
 {
-	win->break_t = FALSE;
+	gmf_thumb_store_insert ( key, pixbuf );
+	gmf_pixbuf_cache_insert_tier ( key, pixbuf );
+}
 
-	win->mod_t = 0; win->limit_t = 0; win->done_t_0 = FALSE; win->end_t = nums / 2;
-	GThread *thread_0_0 = g_thread_new ( NULL, (GThreadFunc)gmf_icon_update_pixbuf_thread, win );
+// The CPU half, when the file's thumbnail is in memory at a bigger size already; takes tier over
+static GdkPixbuf * gmf_win_icon_scale_tier ( const IconFile *file, GdkPixbuf *tier )
+{
+	GdkPixbuf *pixbuf = gmf_thumb_scale ( tier, (uint16_t)( file->key.icon_size * file->key.scale ) );
 
-	g_usleep ( 20000 );
-	win->mod_t = 1; win->limit_t = 0; win->done_t_1 = FALSE;
-	GThread *thread_1_0 = g_thread_new ( NULL, (GThreadFunc)gmf_icon_update_pixbuf_thread, win );
+	if ( file->has_key ) gmf_pixbuf_cache_insert ( &file->key, pixbuf );
 
-	g_usleep ( 20000 );
-	win->mod_t = 0; win->limit_t = 1; win->done_t_2 = FALSE;
-	GThread *thread_0_1 = g_thread_new ( NULL, (GThreadFunc)gmf_icon_update_pixbuf_thread, win );
+	return pixbuf;
+}
 
-	g_usleep ( 20000 );
-	win->mod_t = 1; win->limit_t = 1; win->done_t_3 = FALSE;
-	GThread *thread_1_1 = g_thread_new ( NULL, (GThreadFunc)gmf_icon_update_pixbuf_thread, win );
+// The I/O half of gmf_win_icon_get_pixbuf: only regular image files are read ahead, the rest is cheap to look up
+static GmfThumbData * gmf_win_icon_read_data ( const IconFile *file )
+{
+	if ( file->key.is_link || !file->is_regular ) return NULL;
 
-	g_thread_unref ( thread_0_0 );
-	g_thread_unref ( thread_1_0 );
-	g_thread_unref ( thread_0_1 );
-	g_thread_unref ( thread_1_1 );
+	const char *content_type = gmf_win_icon_file_type ( file );
 
-	g_timeout_add ( 50, (GSourceFunc)gmf_win_icon_update_pixbuf_timeout, win );
+	return ( content_type && g_str_has_prefix ( content_type, "image" ) ) ? gmf_thumb_data_read ( file->path, (uint16_t)( file->key.icon_size * file->key.scale ) ) : NULL;
 }
 
-static uint16_t gmf_icon_get_vis_items ( GmfWin *win )
+// The CPU half: from data when the I/O stage read any, the usual lookup otherwise
+static GdkPixbuf * gmf_win_icon_decode_pixbuf ( const IconFile *file, GmfThumbData *data )
 {
-	int w = gtk_widget_get_allocated_width  ( GTK_WIDGET ( win->icon_view ) );
-	int h = gtk_widget_get_allocated_height ( GTK_WIDGET ( win->icon_view ) );
-
-	int item_col_s = gtk_icon_view_get_column_spacing ( win->icon_view );
-	int item_width = gtk_icon_view_get_item_width ( win->icon_view );
+	GdkPixbuf *pixbuf = ( data ) ? gmf_thumb_data_decode ( data ) : NULL;
 
-	uint16_t ch = (uint16_t)( h / ( item_width - 20 ) );
-	uint16_t cw = (uint16_t)( w / ( item_width + item_col_s ) );
+	if ( pixbuf && file->has_key ) gmf_win_icon_keep_thumb ( &file->key, pixbuf );
 
-	uint16_t items = (uint16_t)( cw * ch );
+	if ( !pixbuf ) pixbuf = gmf_win_icon_load_pixbuf ( file, TRUE );
 
-	items *= 2;
+	if ( pixbuf && file->has_key ) gmf_pixbuf_cache_insert ( &file->key, pixbuf );
 
-	return items;
+	return pixbuf;
 }
 
-static void gmf_icon_model_set_iter ( const char *path, const char *name, gboolean is_dir, gboolean is_slk, gboolean is_pbf, GdkPixbuf *pixbuf, ulong size, GtkTreeModel *model )
+// While scrolling: a cached thumbnail or a cheap stand-in for images, everything else is cheap already
+static GdkPixbuf * gmf_win_icon_get_preview ( const IconFile *file, gboolean *final )
 {
-	GtkTreeIter iter;
-	gtk_list_store_append ( GTK_LIST_STORE ( model ), &iter );
+	const char *content_type = ( file->key.is_link ) ? NULL : gmf_win_icon_file_type ( file );
 
-	gtk_list_store_set ( GTK_LIST_STORE ( model ), &iter,
-		COL_PATH, path,
-		COL_NAME, name,
-		COL_IS_DIR, is_dir,
-		COL_IS_LINK, is_slk,
-		COL_IS_PIXBUF, is_pbf,
-		COL_PIXBUF, pixbuf,
-		COL_SIZE, size,
-		-1 );
-}
+	*final = TRUE;
 
-static void gmf_icon_model_add_file ( GFile *file, GmfWin *win )
-{
-	g_autofree char *path = g_file_get_path ( file );
-	g_autofree char *name = g_file_get_basename ( file );
+	gboolean external = gmf_thumbnailer_supports ( content_type );
 
-	// search ignore
-	if ( name[0] == '.' && !win->hidden ) return;
+	if ( !external && ( !content_type || !g_str_has_prefix ( content_type, "image" ) ) ) return gmf_win_icon_get_pixbuf ( file );
 
-	GtkTreeModel *model = gtk_icon_view_get_model ( win->icon_view );
+	GdkPixbuf *pixbuf = ( file->has_key ) ? gmf_win_icon_lookup ( &file->key ) : NULL;
 
-	ulong size = get_file_size ( path );
-	gboolean is_dir = g_file_test ( path, G_FILE_TEST_IS_DIR );
-	gboolean is_slk = g_file_test ( path, G_FILE_TEST_IS_SYMLINK );
+	if ( pixbuf ) return pixbuf;
 
-	GtkIconTheme *itheme = gtk_icon_theme_get_default ();
+	// Scaling down a bigger one is as cheap as a preview, and final
+	GdkPixbuf *tier = ( file->has_key ) ? gmf_pixbuf_cache_lookup_tier ( &file->key ) : NULL;
 
-	GdkPixbuf *pixbuf = ( win->preview ) ? gmf_win_icon_get_pixbuf ( path, is_slk, win->icon_size ) 
-		: gtk_icon_theme_load_icon ( itheme, ( is_dir ) ? "folder" : "text-x-preview", win->icon_size, GTK_ICON_LOOKUP_FORCE_REGULAR, NULL );
+	if ( tier ) return gmf_win_icon_scale_tier ( file, tier );
 
-	gmf_icon_model_set_iter ( path, name, is_dir, is_slk, TRUE, pixbuf, size, model );
+	// No child process while scrolling: the MIME icon until the thumbnailer has run
+	if ( external ) { *final = FALSE; return gmf_win_icon_load_pixbuf ( file, FALSE ); }
+
+	*final = FALSE;
+
+	pixbuf = gmf_thumb_get_preview ( file->path, (uint16_t)( file->key.icon_size * file->key.scale ) );
+
+	// No cheap preview of this one: the MIME icon, the decode is left to the claim after the scroll
+	return ( pixbuf ) ? pixbuf : gmf_win_icon_load_pixbuf ( file, FALSE );
 }
 
-static int _sort_func_list ( gconstpointer a, gconstpointer b )
+static void thumb_result_free_all ( ThumbResult *res )
 {
-	int ret = 1;
-
-	gboolean is_dir_a = g_file_test ( a, G_FILE_TEST_IS_DIR );
-	gboolean is_dir_b = g_file_test ( b, G_FILE_TEST_IS_DIR );
-	
-	if ( !is_dir_a && is_dir_b )
-		ret = 1;
-	else if ( is_dir_a && !is_dir_b )
-		ret = -1;
-	else
+	while ( res )
 	{
-		g_autofree char *na = g_utf8_collate_key_for_filename ( a, -1 );
-		g_autofree char *nb = g_utf8_collate_key_for_filename ( b, -1 );
+		ThumbResult *next = res->next;
 
-		ret = g_strcmp0 ( na, nb );
-	}
+		g_object_unref ( res->pixbuf );
+		free ( res );
 
-	return ret;
+		res = next;
+	}
 }
 
-static void gmf_win_icon_open_dir ( const char *path_dir, const char *search, GmfWin *win )
+static void thumb_job_unref ( ThumbJob *job )
 {
-	g_return_if_fail ( path_dir != NULL );
-
-	GDir *dir = g_dir_open ( path_dir, 0, NULL );
+	if ( !g_atomic_int_dec_and_test ( &job->ref ) ) return;
 
-	if ( !dir ) { gmf_dialog_message ( "", g_strerror ( errno ), GTK_MESSAGE_WARNING, GTK_WINDOW ( win ) ); return; }
+	thumb_result_free_all ( job->done  );
+	thumb_result_free_all ( job->ready );
 
-	GList *list = NULL;
-	const char *name = NULL;
+	uint i = 0; for ( i = 0; i < job->n_items; i++ )
+	{
+		if ( job->items[i].data ) gmf_thumb_data_free ( job->items[i].data );
+		if ( job->items[i].tier ) g_object_unref ( job->items[i].tier );
 
-	while ( ( name = g_dir_read_name (dir) ) ) list = g_list_append ( list, g_build_filename ( path_dir, name, NULL ) );
+		free ( job->items[i].name );
+	}
 
-	g_dir_close ( dir );
+	g_object_unref ( job->model );
+	g_weak_ref_clear ( &job->win );
+	g_mutex_clear ( &job->mutex );
+	g_cond_clear ( &job->cond );
 
-	GList *list_sort = g_list_sort ( list, _sort_func_list );
+	free ( job->claimed );
+	free ( job->items );
+	free ( job->dir );
+	free ( job );
+}
 
-	win->model_t = ( win->preview ) ? gmf_win_icon_create_model ( win ) : NULL;
+static void thumb_job_push ( ThumbJob *job, ThumbResult *res )
+{
+	do res->next = g_atomic_pointer_get ( &job->done );
+	while ( !g_atomic_pointer_compare_and_exchange ( &job->done, res->next, res ) );
+}
 
-	uint nums = 0;
-	uint16_t items = gmf_icon_get_vis_items ( win );
-	GtkIconTheme *itheme = gtk_icon_theme_get_default ();
-	GtkTreeModel *model  = gtk_icon_view_get_model ( win->icon_view );
+// Takes everything pushed so far and appends it, oldest first, to the ready list
+static void thumb_job_take ( ThumbJob *job )
+{
+	ThumbResult *res = NULL;
 
-	gtk_list_store_clear ( GTK_LIST_STORE ( model ) );
+	do res = g_atomic_pointer_get ( &job->done );
+	while ( !g_atomic_pointer_compare_and_exchange ( &job->done, res, NULL ) );
 
-	while ( list_sort != NULL )
-	{
-		char *path = (char *)list_sort->data;
-		char *name = g_path_get_basename ( path );
+	ThumbResult *list = NULL, *tail = res;
 
-		char *display_name = g_filename_to_utf8 ( name, -1, NULL, NULL, NULL );
-		char *display_name_down = ( search ) ? g_utf8_strdown ( display_name, -1 ) : NULL;
+	while ( res ) { ThumbResult *next = res->next; res->next = list; list = res; res = next; }
 
-		if ( name[0] != '.' || win->hidden )
-		if ( !search || ( search && g_strrstr ( display_name_down, search ) ) )
-		{
-			ulong size = get_file_size ( path );
-			gboolean is_dir = g_file_test ( path, G_FILE_TEST_IS_DIR );
-			gboolean is_slk = g_file_test ( path, G_FILE_TEST_IS_SYMLINK );
+	if ( !list ) return;
 
-			if ( win->preview )
-			{
-				if ( nums < items )
-				{
-					GdkPixbuf *pixbuf = gmf_win_icon_get_pixbuf ( path, is_slk, win->icon_size );
+	if ( job->ready_tail ) job->ready_tail->next = list; else job->ready = list;
 
-					gmf_icon_model_set_iter ( path, display_name, is_dir, is_slk, TRUE, pixbuf, size, model );
-					gmf_icon_model_set_iter ( path, display_name, is_dir, is_slk, TRUE, pixbuf, size, win->model_t );
+	job->ready_tail = tail;
+}
 
-					if ( pixbuf ) g_object_unref ( pixbuf );
-				}
-				else
-					gmf_icon_model_set_iter ( path, display_name, is_dir, is_slk, FALSE, NULL, size, win->model_t );
-			}
-			else
-			{
-				GdkPixbuf *pixbuf = gtk_icon_theme_load_icon ( itheme, ( is_dir ) ? "folder" : "text-x-preview", win->icon_size, GTK_ICON_LOOKUP_FORCE_REGULAR, NULL );
+// Next position in claim order; FALSE once every cursor has left the item range
+static gboolean thumb_job_cursor ( ThumbJob *job, gboolean over, uint *indx )
+{
+	if ( job->vis < job->vis_end ) { *indx = job->vis++; return TRUE; }
 
-				gmf_icon_model_set_iter ( path, display_name, is_dir, is_slk, TRUE, pixbuf, size, model );
+	// Past the ceiling, one screen on either side: the screens are counted in rows, so still within the items
+	int lo = ( over ) ? MAX ( job->keep_lo, 0 ) : 0, hi = ( over ) ? MIN ( job->keep_hi, (int)job->n_items ) : (int)job->n_items, i = 0;
 
-				if ( pixbuf ) g_object_unref ( pixbuf );
-			}
+	gboolean ahead_ok  = ( job->ahead  >= lo && job->ahead  < hi );
+	gboolean behind_ok = ( job->behind >= lo && job->behind < hi );
 
-			nums++;
-		}
+	if ( !ahead_ok && !behind_ok ) return FALSE;
 
-		free ( name );
-		free ( display_name );
-		free ( display_name_down );
+	// The prefetch margin first, then both directions in turn
+	if ( ahead_ok && ( job->margin || job->turn || !behind_ok ) )
+	{
+		i = job->ahead;
+		job->ahead += job->step;
 
-		list_sort = list_sort->next;
+		if ( job->margin ) job->margin--; else job->turn = FALSE;
 	}
+	else
+	{
+		i = job->behind;
+		job->behind -= job->step;
 
-	g_list_free_full ( list, (GDestroyNotify) free );
+		job->turn = TRUE;
+	}
 
-	if ( win->preview && nums >= items ) gmf_icon_update_pixbuf_all ( nums, win ); else { if ( win->model_t ) g_object_unref ( win->model_t ); win->model_t = NULL; }
+	*indx = (uint)i;
 
-	gtk_icon_view_scroll_to_path ( win->icon_view, gtk_tree_path_new_first (), FALSE, 0, 0 );
+	return TRUE;
 }
 
-static gboolean gmf_win_icon_open_dir_timeout ( GmfWin *win )
+enum thumb_claim_enm
 {
-	if ( !GTK_IS_WIDGET ( win->icon_view ) ) return FALSE;
+	CLAIM_NONE,
+	CLAIM_PREVIEW,
+	CLAIM_FINAL
+};
 
-	if ( win->model_t == NULL )
-	{
-		const char *search = NULL;
-		g_autofree char *path = g_file_get_path ( win->file );
+static gboolean thumb_job_claim ( ThumbJob *job, gboolean fast, uint *indx )
+{
+	uint i = 0;
+	gboolean found = FALSE;
 
-		if ( gtk_widget_is_visible ( GTK_WIDGET ( win->entry_search ) ) ) search = gtk_entry_get_text ( win->entry_search );
+	gboolean over = g_atomic_int_get ( &job->over );
 
-		ulong len = ( search ) ? strlen ( search ) : 0;
+	uint8_t claim = ( fast ) ? CLAIM_PREVIEW : CLAIM_FINAL;
 
-		if ( len == 0 )
-			gmf_win_icon_open_dir ( path, NULL, win );
-		else
-		{
-			g_autofree char *search_down = g_utf8_strdown ( search, -1 );
+	g_mutex_lock ( &job->mutex );
 
-			gmf_win_icon_open_dir ( path, search_down, win );
-		}
+	while ( ( found = thumb_job_cursor ( job, over, &i ) ) && job->claimed[i] >= claim );
 
-		return FALSE;
+	if ( found ) job->claimed[i] = claim;
+
+	g_mutex_unlock ( &job->mutex );
+
+	if ( found ) *indx = i;
+
+	return found;
+}
+
+// Items [start, end) are on screen; down is the scroll direction
+static void thumb_job_set_view ( ThumbJob *job, uint start, uint end, gboolean down )
+{
+	g_mutex_lock ( &job->mutex );
+
+	job->vis     = start;
+	job->vis_end = end;
+	job->margin  = end - start;
+
+	job->step   = ( down ) ? 1 : -1;
+	job->ahead  = ( down ) ? (int)end : (int)start - 1;
+	job->behind = ( down ) ? (int)start - 1 : (int)end;
+	job->turn   = FALSE;
+
+	job->keep_lo = (int)start - (int)job->margin;
+	job->keep_hi = (int)( end + job->margin );
+
+	g_mutex_unlock ( &job->mutex );
+}
+
+// Index of the first item at or after row
+static uint thumb_job_find_row ( ThumbJob *job, uint row )
+{
+	uint lo = 0, hi = job->n_items;
+
+	while ( lo < hi )
+	{
+		uint mid = lo + ( hi - lo ) / 2;
+
+		if ( job->items[mid].row < row ) lo = mid + 1; else hi = mid;
+	}
+
+	return lo;
+}
+
+static void thumb_job_result ( ThumbJob *job, uint indx, gboolean final, GdkPixbuf *pixbuf )
+{
+	// Decoded for a folder that is no longer shown
+	if ( pixbuf && g_atomic_int_get ( &job->cancel ) ) { g_object_unref ( pixbuf ); pixbuf = NULL; }
+
+	if ( !pixbuf ) return;
+
+	ThumbResult *res = g_new0 ( ThumbResult, 1 );
+
+	res->indx = indx;
+	res->final = final;
+	res->pixbuf = pixbuf;
+
+	thumb_job_push ( job, res );
+}
+
+typedef struct _ThumbWait ThumbWait;
+
+struct _ThumbWait
+{
+	ThumbJob *job;
+	uint indx;
+	char *path;
+	IconFile file;
+};
+
+// From the thumbnailer's runner thread, or right away when the cache already had the answer
+static void thumb_job_external_done ( GdkPixbuf *pixbuf, ThumbWait *wait )
+{
+	ThumbJob *job = wait->job;
+
+	const IconFile *file = &wait->file;
+
+	if ( pixbuf && file->has_key ) gmf_win_icon_keep_thumb ( &file->key, pixbuf );
+
+	if ( !pixbuf && !g_atomic_int_get ( &job->cancel ) ) pixbuf = gmf_win_icon_load_pixbuf ( file, TRUE );
+
+	if ( pixbuf && file->has_key ) gmf_pixbuf_cache_insert ( &file->key, pixbuf );
+
+	thumb_job_result ( job, wait->indx, TRUE, pixbuf );
+
+	free ( wait->path );
+	free ( wait );
+
+	g_atomic_int_add ( &job->left, -1 );
+
+	thumb_job_unref ( job );
+}
+
+// Video, PDF and the like: handed to a thumbnailer process, the row is done when it answers
+static gboolean thumb_job_external ( ThumbJob *job, uint indx, IconFile *file )
+{
+	const char *path = file->path;
+
+	// Sniffed, as for the MIME icon: the thumbnailer is picked by what the file is, not what it is called.
+	// Kept in file, for the MIME icon when no thumbnailer takes it.
+	if ( !file->content_type ) file->content_type = gmf_win_icon_file_type ( file );
+
+	const char *content_type = file->content_type;
+
+	if ( !gmf_thumbnailer_supports ( content_type ) ) return FALSE;
+
+	ThumbWait *wait = g_new0 ( ThumbWait, 1 );
+
+	wait->job = job;
+	wait->indx = indx;
+	wait->path = g_strdup ( path );
+	wait->file = *file;
+	wait->file.path = wait->path;
+
+	g_atomic_int_inc ( &job->ref  );
+	g_atomic_int_inc ( &job->left );
+
+	if ( gmf_thumb_external ( path, content_type, (uint16_t)( job->icon_size * job->scale ), &job->cancel, (GmfThumbFunc)thumb_job_external_done, wait ) ) return TRUE;
+
+	// The caller still holds its own reference
+	g_atomic_int_add ( &job->left, -1 );
+	g_atomic_int_add ( &job->ref,  -1 );
+
+	free ( wait->path );
+	free ( wait );
+
+	return FALSE;
+}
+
+// Decode stage: task is the item index, shifted, with the preview flag in the low bit
+static void thumb_job_item ( uint task, ThumbJob *job )
+{
+	uint indx = task >> 1;
+
+	gboolean fast = ( task & 1 ), final = TRUE;
+
+	ThumbItem *item = &job->items[indx];
+
+	// Only a full-quality claim comes with data; a row is claimed that way once
+	GmfThumbData *data = ( fast ) ? NULL : item->data;
+	GdkPixbuf *tier = ( fast ) ? NULL : item->tier;
+
+	if ( !fast ) { item->data = NULL; item->tier = NULL; }
+
+	size_t bytes = ( data ) ? gmf_thumb_data_get_size ( data ) : 0;
+
+	if ( !g_atomic_int_get ( &job->cancel ) )
+	{
+		g_autofree char *path = g_build_filename ( job->dir, item->name, NULL );
+
+		IconFile file = item->file;
+		file.path = path;
+
+		GdkPixbuf *pixbuf = NULL;
+
+		// A file gone since the listing gets its MIME icon at worst: the monitor drops its row anyway
+		if ( fast )
+			pixbuf = gmf_win_icon_get_preview ( &file, &final );
+		else if ( tier )
+			{ pixbuf = gmf_win_icon_scale_tier ( &file, tier ); tier = NULL; }
+		else if ( data || file.key.is_link || !file.is_regular || !thumb_job_external ( job, indx, &file ) )
+			pixbuf = gmf_win_icon_decode_pixbuf ( &file, data );
+
+		if ( fast && final ) { g_mutex_lock ( &job->mutex ); job->claimed[indx] = CLAIM_FINAL; g_mutex_unlock ( &job->mutex ); }
+
+		if ( !final ) g_atomic_int_inc ( &job->requeue );
+
+		thumb_job_result ( job, indx, final, pixbuf );
+	}
+
+	if ( data ) gmf_thumb_data_free ( data );
+	if ( tier ) g_object_unref ( tier );
+
+	g_mutex_lock ( &job->mutex );
+
+	job->io_bytes -= bytes;
+	job->io_tasks--;
+
+	g_cond_signal ( &job->cond );
+	g_mutex_unlock ( &job->mutex );
+
+	g_atomic_int_add ( &job->left, -1 );
+
+	thumb_job_unref ( job );
+}
+
+// Reads what the row needs, once the decode stage has room for it, and queues its task
+static void thumb_job_io_item ( ThumbJob *job, uint indx, gboolean fast, uint limit )
+{
+	ThumbItem *item = &job->items[indx];
+
+	g_mutex_lock ( &job->mutex );
+
+	while ( !g_atomic_int_get ( &job->cancel ) && job->io_tasks && ( job->io_tasks >= limit || job->io_bytes >= THUMB_IO_BYTES ) )
+		g_cond_wait ( &job->cond, &job->mutex );
+
+	g_mutex_unlock ( &job->mutex );
+
+	if ( g_atomic_int_get ( &job->cancel ) ) return;
+
+	g_autofree char *path = g_build_filename ( job->dir, item->name, NULL );
+
+	IconFile file = item->file;
+	file.path = path;
+
+	// Sniffed here, on the I/O thread, before the row's first task: every stage after goes by this type
+	if ( !file.content_type && file.is_regular && file.has_key ) item->file.content_type = file.content_type = gmf_win_icon_file_type ( &file );
+
+	if ( !fast )
+	{
+		GdkPixbuf *pixbuf = ( file.has_key ) ? gmf_win_icon_lookup ( &file.key ) : NULL;
+
+		// Decoded before, here or in another window: nothing to read or decode
+		if ( pixbuf ) { thumb_job_result ( job, indx, TRUE, pixbuf ); return; }
+
+		// Decoded at a bigger size: the decode stage only scales it down
+		item->tier = ( file.has_key ) ? gmf_pixbuf_cache_lookup_tier ( &file.key ) : NULL;
+
+		if ( !item->tier ) item->data = gmf_win_icon_read_data ( &file );
+	}
+
+	g_mutex_lock ( &job->mutex );
+
+	job->io_bytes += ( item->data && !fast ) ? gmf_thumb_data_get_size ( item->data ) : 0;
+	job->io_tasks++;
+
+	g_mutex_unlock ( &job->mutex );
+
+	g_atomic_int_inc ( &job->ref  );
+	g_atomic_int_inc ( &job->left );
+
+	gmf_pool_push ( gmf_pool_get_default (), (GmfPoolFunc)thumb_job_item, indx << 1 | ( fast ? 1 : 0 ), job );
+}
+
+typedef struct _ThumbRead ThumbRead;
+
+struct _ThumbRead
+{
+	uint indx;
+	uint64_t inode;
+};
+
+static int thumb_read_cmp ( const void *a, const void *b )
+{
+	uint64_t ia = ( (const ThumbRead *)a )->inode, ib = ( (const ThumbRead *)b )->inode;
+
+	return ( ia > ib ) - ( ia < ib );
+}
+
+/* I/O stage. Full-quality rows are claimed a batch at a time and read in inode order, which on
+ * most file systems follows the on-disk layout closely enough to save seeks on spinning disks and
+ * USB sticks. Previews are claimed one by one: their tasks do their own small reads. */
+static gpointer thumb_job_io ( ThumbJob *job )
+{
+	uint limit = 2 * gmf_pool_get_n_threads ( gmf_pool_get_default () );
+
+	ThumbRead batch[THUMB_IO_BATCH];
+
+	while ( !g_atomic_int_get ( &job->cancel ) )
+	{
+		gboolean fast = g_atomic_int_get ( &job->scrolling );
+
+		uint n = 0, i = 0, indx = 0;
+
+		while ( n < ( ( fast ) ? 1 : THUMB_IO_BATCH ) && thumb_job_claim ( job, fast, &indx ) ) batch[n++].indx = indx;
+
+		if ( !n )
+		{
+			g_mutex_lock ( &job->mutex );
+
+			gboolean again = job->io_again;
+
+			job->io_again = FALSE;
+			if ( !again ) job->io_run = FALSE;
+
+			g_mutex_unlock ( &job->mutex );
+
+			if ( again ) continue; else break;
+		}
+
+		// The listing's inode: nothing is stat'ed to sort the batch
+		for ( i = 0; i < n && !fast; i++ ) batch[i].inode = job->items[batch[i].indx].file.key.inode;
+
+		if ( !fast ) qsort ( batch, n, sizeof ( ThumbRead ), thumb_read_cmp );
+
+		for ( i = 0; i < n; i++ ) thumb_job_io_item ( job, batch[i].indx, fast, limit );
+	}
+
+	g_atomic_int_add ( &job->left, -1 );
+
+	thumb_job_unref ( job );
+
+	return NULL;
+}
+
+static void thumb_job_io_start ( ThumbJob *job )
+{
+	g_atomic_int_inc ( &job->ref  );
+	g_atomic_int_inc ( &job->left );
+
+	g_thread_unref ( g_thread_new ( "thumb-io", (GThreadFunc)thumb_job_io, job ) );
+}
+
+// New rows to claim: the I/O thread goes on, or starts again when it has already run out
+static void thumb_job_io_wake ( ThumbJob *job )
+{
+	g_mutex_lock ( &job->mutex );
+
+	gboolean run = job->io_run;
+
+	if ( run ) job->io_again = TRUE; else job->io_run = TRUE;
+
+	g_mutex_unlock ( &job->mutex );
+
+	if ( !run ) thumb_job_io_start ( job );
+}
+
+static gboolean thumb_job_find_iter ( ThumbJob *job, uint indx, GtkTreeIter *iter )
+{
+	GmfDirModel *model = GMF_DIR_MODEL ( job->model );
+
+	const char *name = job->items[indx].name;
+
+	// Rows may have moved since the job started: the row is only a hint
+	gboolean found = gtk_tree_model_iter_nth_child ( job->model, iter, NULL, (int)job->items[indx].row ) && g_str_equal ( gmf_dir_model_get_name ( model, iter ), name );
+
+	return ( found ) ? TRUE : gmf_dir_model_find ( model, name, iter );
+}
+
+static void thumb_job_apply ( ThumbJob *job, ThumbResult *res )
+{
+	GtkTreeIter iter;
+	GmfDirModel *model = GMF_DIR_MODEL ( job->model );
+
+	if ( !thumb_job_find_iter ( job, res->indx, &iter ) ) return;
+
+	if ( res->final ) gmf_dir_model_set_pixbuf_quiet ( model, &iter, res->pixbuf ); else gmf_dir_model_set_preview ( model, &iter, res->pixbuf );
+}
+
+// Once the job is through: rows it claimed at full quality are not claimed again by the next one,
+// whether or not they got a thumbnail. Rows left out near the ceiling are.
+static void thumb_job_mark_attempted ( ThumbJob *job )
+{
+	GtkTreeIter iter;
+
+	uint i = 0; for ( i = 0; i < job->n_items; i++ )
+		if ( job->claimed[i] == CLAIM_FINAL && thumb_job_find_iter ( job, i, &iter ) ) gmf_dir_model_set_attempted ( GMF_DIR_MODEL ( job->model ), &iter );
+}
+
+static void gmf_win_icon_update_pixbuf_end ( ThumbJob *job, GmfWin *win )
+{
+	if ( win->thumb == job ) win->thumb = NULL;
+
+	thumb_job_unref ( job );
+}
+
+static gboolean gmf_win_icon_view_rows ( GmfWin *win, uint *start, uint *end )
+{
+	GtkTreePath *start_path = NULL, *end_path = NULL;
+
+	if ( !gtk_icon_view_get_visible_range ( win->icon_view, &start_path, &end_path ) ) return FALSE;
+
+	*start = (uint)gtk_tree_path_get_indices ( start_path )[0];
+	*end   = (uint)gtk_tree_path_get_indices ( end_path   )[0] + 1;
+
+	gtk_tree_path_free ( start_path );
+	gtk_tree_path_free ( end_path );
+
+	return TRUE;
+}
+
+// Keep the shown thumbnails under the window's ceiling: the viewport and one screen on either side stay
+static void gmf_win_icon_evict ( GmfWin *win )
+{
+	GtkTreeModel *model = gtk_icon_view_get_model ( win->icon_view );
+
+	uint64_t limit = (uint64_t)win->thumb_mb << 20;
+
+	if ( !win->preview || !model || gmf_dir_model_get_bytes ( GMF_DIR_MODEL ( model ) ) <= limit ) return;
+
+	uint start = 0, end = 0;
+
+	if ( !gmf_win_icon_view_rows ( win, &start, &end ) ) return;
+
+	uint span = end - start;
+
+	GdkPixbuf *pixbuf_dir  = gmf_win_icon_placeholder ( TRUE,  win );
+	GdkPixbuf *pixbuf_file = gmf_win_icon_placeholder ( FALSE, win );
+
+	uint n = gmf_dir_model_evict ( GMF_DIR_MODEL ( model ), ( start > span ) ? start - span : 0, end + span, limit, pixbuf_dir, pixbuf_file );
+
+	if ( n ) gtk_widget_queue_draw ( GTK_WIDGET ( win->icon_view ) );
+
+	if ( pixbuf_dir  ) g_object_unref ( pixbuf_dir  );
+	if ( pixbuf_file ) g_object_unref ( pixbuf_file );
+}
+
+static gboolean gmf_win_icon_update_pixbuf_tick ( ThumbJob *job, GmfWin *win )
+{
+	// Replaced by a job that knows the rows a refresh added: its results would only come late
+	if ( !GTK_IS_WIDGET ( win->icon_view ) || gtk_icon_view_get_model ( win->icon_view ) != job->model || win->thumb != job )
+		{ gmf_win_icon_update_pixbuf_end ( job, win ); return FALSE; }
+
+	// Read before taking, so that no result pushed in between is left behind
+	gboolean done = ( g_atomic_int_get ( &job->left ) == 0 );
+
+	thumb_job_take ( job );
+
+	uint n = 0;
+	int64_t end = g_get_monotonic_time () + THUMB_BUDGET;
+
+	while ( job->ready && ( n == 0 || g_get_monotonic_time () < end ) )
+	{
+		ThumbResult *res = job->ready;
+
+		job->ready = res->next;
+		if ( !job->ready ) job->ready_tail = NULL;
+
+		thumb_job_apply ( job, res );
+
+		g_object_unref ( res->pixbuf );
+		free ( res );
+
+		n++;
+	}
+
+	// One redraw per batch instead of a relayout per row
+	if ( n ) gtk_widget_queue_draw ( GTK_WIDGET ( win->icon_view ) );
+
+	// At the ceiling once, the rest of the job stays near the viewport
+	if ( n && gmf_dir_model_get_bytes ( GMF_DIR_MODEL ( job->model ) ) > (uint64_t)win->thumb_mb << 20 )
+		{ g_atomic_int_set ( &job->over, TRUE ); gmf_win_icon_evict ( win ); }
+
+	if ( done && !job->ready ) { thumb_job_mark_attempted ( job ); gmf_win_icon_update_pixbuf_end ( job, win ); return FALSE; }
+
+	return TRUE;
+}
+
+static gboolean gmf_win_icon_update_pixbuf_timeout ( ThumbJob *job )
+{
+	GmfWin *win = g_weak_ref_get ( &job->win );
+
+	// The window is gone or at a new generation: whatever is still decoding holds its own reference, nothing here waits for it
+	if ( !win || job->gen != win->gen ) { if ( win ) g_object_unref ( win ); thumb_job_unref ( job ); return FALSE; }
+
+	// Held for the tick: nothing it calls can pull the window from under it
+	gboolean ret = gmf_win_icon_update_pixbuf_tick ( job, win );
+
+	g_object_unref ( win );
+
+	return ret;
+}
+
+static uint16_t gmf_icon_get_vis_items ( GmfWin *win )
+{
+	int w = gtk_widget_get_allocated_width  ( GTK_WIDGET ( win->icon_view ) );
+	int h = gtk_widget_get_allocated_height ( GTK_WIDGET ( win->icon_view ) );
+
+	int item_col_s = gtk_icon_view_get_column_spacing ( win->icon_view );
+	int item_width = gtk_icon_view_get_item_width ( win->icon_view );
+
+	uint16_t ch = (uint16_t)( h / ( item_width - 20 ) );
+	uint16_t cw = (uint16_t)( w / ( item_width + item_col_s ) );
+
+	uint16_t items = (uint16_t)( cw * ch );
+
+	items *= 2;
+
+	return items;
+}
+
+/* Rows evicted earlier, or never claimed under the ceiling, come back when they are scrolled into view.
+ * A row a job has been through without a result (gone, unreadable) does not start another one. */
+static void gmf_win_icon_thumb_resume ( uint start, uint end, GmfWin *win )
+{
+	GtkTreeModel *model = gtk_icon_view_get_model ( win->icon_view );
+
+	if ( !win->preview || !model || win->load || win->model_t ) return;
+
+	GtkTreeIter iter;
+	gboolean valid = FALSE, due = FALSE;
+
+	for ( valid = gtk_tree_model_iter_nth_child ( model, &iter, NULL, (int)start ); valid && !due && start < end; valid = gtk_tree_model_iter_next ( model, &iter ), start++ )
+		due = gmf_dir_model_is_due ( GMF_DIR_MODEL ( model ), &iter );
+
+	if ( due ) gmf_icon_update_pixbuf_all ( model, win );
+}
+
+static void gmf_win_icon_thumb_priority ( GmfWin *win )
+{
+	ThumbJob *job = win->thumb;
+
+	uint start = 0, end = 0;
+
+	if ( !gmf_win_icon_view_rows ( win, &start, &end ) ) return;
+
+	if ( !job ) { gmf_win_icon_thumb_resume ( start, end, win ); return; }
+
+	if ( g_atomic_int_get ( &job->left ) == 0 ) return;
+
+	double scroll = gtk_adjustment_get_value ( gtk_scrolled_window_get_vadjustment ( win->scw ) );
+
+	thumb_job_set_view ( job, thumb_job_find_row ( job, start ), thumb_job_find_row ( job, end ), ( scroll >= job->scroll ) );
+
+	job->scroll = scroll;
+
+	gmf_win_icon_evict ( win );
+}
+
+static gboolean gmf_win_icon_scroll_stop ( GmfWin *win )
+{
+	win->scroll_id = 0;
+
+	ThumbJob *job = win->thumb;
+
+	int k = 0;
+
+	if ( job )
+	{
+		g_atomic_int_set ( &job->scrolling, FALSE );
+
+		do k = g_atomic_int_get ( &job->requeue );
+		while ( !g_atomic_int_compare_and_exchange ( &job->requeue, k, 0 ) );
+	}
+
+	// Cursors back on the viewport before the previews are claimed again at full quality
+	gmf_win_icon_thumb_priority ( win );
+
+	if ( k ) thumb_job_io_wake ( job );
+
+	return FALSE;
+}
+
+static void gmf_win_icon_scroll_changed ( G_GNUC_UNUSED GtkAdjustment *adj, GmfWin *win )
+{
+	if ( win->thumb ) g_atomic_int_set ( &win->thumb->scrolling, TRUE );
+
+	if ( win->scroll_id ) g_source_remove ( win->scroll_id );
+
+	win->scroll_id = g_timeout_add ( SCROLL_STOP, (GSourceFunc)gmf_win_icon_scroll_stop, win );
+
+	gmf_win_icon_thumb_priority ( win );
+}
+
+static void gmf_win_icon_size_allocate ( G_GNUC_UNUSED GtkWidget *widget, G_GNUC_UNUSED GdkRectangle *alloc, GmfWin *win )
+{
+	gmf_win_icon_thumb_priority ( win );
+}
+
+static void gmf_icon_update_pixbuf_all ( GtkTreeModel *model, GmfWin *win )
+{
+	ThumbJob *job = g_new0 ( ThumbJob, 1 );
+
+	job->dir = g_strdup ( gmf_dir_model_get_dir ( GMF_DIR_MODEL ( model ) ) );
+	job->gen = win->gen;
+	g_weak_ref_init ( &job->win, win );
+	job->icon_size = win->icon_size;
+	job->scale = win->scale;
+	job->scrolling = ( win->scroll_id != 0 );
+	job->model = g_object_ref ( model );
+	job->items = g_new0 ( ThumbItem, gtk_tree_model_iter_n_children ( model, NULL ) );
+
+	GtkTreeIter iter;
+	gboolean valid = FALSE;
+	uint row = 0;
+
+	for ( valid = gtk_tree_model_get_iter_first ( model, &iter ); valid; valid = gtk_tree_model_iter_next ( model, &iter ), row++ )
+	{
+		if ( !gmf_dir_model_is_due ( GMF_DIR_MODEL ( model ), &iter ) ) continue;
+
+		job->items[job->n_items].name = g_strdup ( gmf_dir_model_get_name ( GMF_DIR_MODEL ( model ), &iter ) );
+		job->items[job->n_items].row  = row;
+		gmf_win_icon_file_init_row ( model, &iter, job->icon_size, job->scale, &job->items[job->n_items].file );
+		job->n_items++;
+	}
+
+	job->ref  = 1;
+	job->left = 0;
+
+	g_mutex_init ( &job->mutex );
+	g_cond_init ( &job->cond );
+	job->claimed = g_new0 ( uint8_t, job->n_items );
+
+	win->thumb = job;
+
+	// Until the view is laid out: the top of the list, a guessed screen at a time
+	thumb_job_set_view ( job, 0, MIN ( job->n_items, gmf_icon_get_vis_items ( win ) ), TRUE );
+	gmf_win_icon_thumb_priority ( win );
+
+	job->io_run = TRUE;
+	thumb_job_io_start ( job );
+
+	g_timeout_add ( THUMB_TICK, (GSourceFunc)gmf_win_icon_update_pixbuf_timeout, job );
+}
+
+static int gmf_icon_model_sort_pos ( const GmfDirEntry *entry, GtkTreeModel *model, GmfWin *win )
+{
+	GmfDirSort rec, probe;
+	gmf_dir_sort_set ( 0, entry, &rec );
+
+	int lo = 0, hi = gtk_tree_model_iter_n_children ( model, NULL );
+
+	// The store is kept in win->sort_num order, so a single file goes in by binary search
+	while ( lo < hi )
+	{
+		int mid = lo + ( hi - lo ) / 2;
+
+		GtkTreeIter iter;
+		gtk_tree_model_iter_nth_child ( model, &iter, NULL, mid );
+
+		g_autofree char *name = NULL;
+		uint64_t size = 0;
+		gboolean is_dir = FALSE;
+
+		gtk_tree_model_get ( model, &iter, COL_NAME, &name, COL_IS_DIR, &is_dir, COL_SIZE, &size, -1 );
+
+		probe.key  = g_utf8_collate_key_for_filename ( name, -1 );
+		probe.size = size;
+		probe.indx = 0;
+		probe.is_dir = is_dir;
+
+		if ( gmf_dir_sort_cmp ( &probe, &rec, win->sort_num ) <= 0 ) lo = mid + 1; else hi = mid;
+
+		gmf_dir_sort_clear ( &probe );
+	}
+
+	gmf_dir_sort_clear ( &rec );
+
+	return lo;
+}
+
+static GdkPixbuf * gmf_icon_model_entry_pixbuf ( const char *path, const GmfDirEntry *entry, GmfWin *win )
+{
+	if ( !win->preview ) return gmf_win_icon_placeholder ( entry->is_dir, win );
+
+	IconFile file;
+	gmf_win_icon_file_init_entry ( path, entry, win->icon_size, win->scale, &file );
+
+	return gmf_win_icon_get_pixbuf ( &file );
+}
+
+static void gmf_icon_model_insert_entry ( const char *path, const GmfDirEntry *entry, GtkTreeModel *model, GmfWin *win )
+{
+	GdkPixbuf *pixbuf = gmf_icon_model_entry_pixbuf ( path, entry, win );
+
+	int pos = gmf_icon_model_sort_pos ( entry, model, win );
+
+	gmf_dir_model_insert ( GMF_DIR_MODEL ( model ), pos, entry, TRUE, pixbuf );
+
+	if ( pixbuf ) g_object_unref ( pixbuf );
+}
+
+static void gmf_icon_model_add_file ( GFile *file, GmfWin *win )
+{
+	g_autofree char *path = g_file_get_path ( file );
+	g_autofree char *name = g_file_get_basename ( file );
+
+	// search ignore
+	if ( name[0] == '.' && !win->hidden ) return;
+
+	GtkTreeModel *model = gtk_icon_view_get_model ( win->icon_view );
+
+	GmfDirEntry *entry = gmf_dir_entry_new_for_path ( path );
+
+	gmf_icon_model_insert_entry ( path, entry, model, win );
+
+	gmf_dir_entry_free ( entry );
+}
+
+// Batches only point at entries owned by load->list
+static GPtrArray * dir_load_batch_new ( void )
+{
+	return g_ptr_array_new ();
+}
+
+static void dir_load_unref ( DirLoad *load )
+{
+	if ( !g_atomic_int_dec_and_test ( &load->ref ) ) return;
+
+	GPtrArray *batch = NULL;
+	while ( ( batch = g_async_queue_try_pop ( load->queue ) ) ) g_ptr_array_unref ( batch );
+
+	if ( load->batch ) g_ptr_array_unref ( load->batch );
+
+	if ( load->list ) gmf_dir_list_unref ( load->list );
+
+	if ( load->pixbuf_dir  ) g_object_unref ( load->pixbuf_dir  );
+	if ( load->pixbuf_file ) g_object_unref ( load->pixbuf_file );
+
+	g_async_queue_unref ( load->queue );
+	g_object_unref ( load->cancellable );
+	g_weak_ref_clear ( &load->win );
+
+	free ( load->order );
+	free ( load->error );
+	free ( load->search );
+	free ( load->path );
+	free ( load );
+}
+
+static gboolean dir_load_filter ( const char *name, DirLoad *load )
+{
+	if ( name[0] == '.' && !load->hidden ) return FALSE;
+
+	if ( !load->search ) return TRUE;
+
+	g_autofree char *display_name = g_filename_display_name ( name );
+	g_autofree char *display_name_down = g_utf8_strdown ( display_name, -1 );
+
+	return ( g_strrstr ( display_name_down, load->search ) != NULL );
+}
+
+static void dir_load_sort_first ( GPtrArray *batch, GArray *recs, DirLoad *load )
+{
+	GmfDirSort *rec = &g_array_index ( recs, GmfDirSort, 0 );
+
+	gmf_dir_sort ( rec, recs->len, load->sort );
+
+	gpointer *pdata = g_new ( gpointer, batch->len );
+	memcpy ( pdata, batch->pdata, batch->len * sizeof ( gpointer ) );
+
+	uint i = 0; for ( i = 0; i < recs->len; i++ ) { batch->pdata[i] = pdata[rec[i].indx]; rec[i].indx = i; }
+
+	memcpy ( load->list->entries->pdata, batch->pdata, batch->len * sizeof ( gpointer ) );
+
+	free ( pdata );
+}
+
+static void dir_load_sort_all ( GArray *recs, DirLoad *load )
+{
+	GmfDirSort *rec = &g_array_index ( recs, GmfDirSort, 0 );
+
+	if ( recs->len && !g_cancellable_is_cancelled ( load->cancellable ) )
+	{
+		gmf_dir_sort ( rec, recs->len, load->sort );
+
+		// new_order[new position] = position the row was streamed at
+		int *order = g_new ( int, recs->len );
+
+		uint i = 0; for ( i = 0; i < recs->len; i++ ) order[i] = (int)rec[i].indx;
+
+		// The listing kept for the cache is stored in display order
+		GPtrArray *entries = load->list->entries;
+		gpointer *pdata = g_new ( gpointer, entries->len );
+		memcpy ( pdata, entries->pdata, entries->len * sizeof ( gpointer ) );
+
+		for ( i = 0; i < recs->len; i++ ) entries->pdata[i] = pdata[order[i]];
+
+		free ( pdata );
+
+		load->order = order;
+	}
+
+	uint i = 0; for ( i = 0; i < recs->len; i++ ) gmf_dir_sort_clear ( &rec[i] );
+}
+
+static gpointer dir_load_thread ( DirLoad *load )
+{
+	GError *error = NULL;
+
+	// Taken before reading, so that any change made during the read makes the listing stale
+	load->list->mtime = gmf_dir_cache_mtime ( load->path );
+
+	GmfDir *dir = gmf_dir_open ( load->path, &error );
+
+	if ( error ) { load->error = g_strdup ( error->message ); g_error_free ( error ); }
+
+	if ( dir )
+	{
+		uint limit = load->first;
+		const char *name = NULL;
+
+		GArray *recs = g_array_new ( FALSE, FALSE, sizeof ( GmfDirSort ) );
+
+		GPtrArray *batch = dir_load_batch_new ();
+		int64_t flush = g_get_monotonic_time () + LOAD_FLUSH;
+
+		while ( ( name = gmf_dir_read_name ( dir ) ) )
+		{
+			if ( g_cancellable_is_cancelled ( load->cancellable ) ) break;
+
+			// Filter on the name first: hidden and unmatched entries never cost a syscall
+			if ( !dir_load_filter ( name, load ) ) continue;
+
+			GmfDirEntry *entry = gmf_dir_read_entry ( dir );
+
+			GmfDirSort rec;
+			gmf_dir_sort_set ( recs->len, entry, &rec );
+			g_array_append_val ( recs, rec );
+
+			g_ptr_array_add ( load->list->entries, entry );
+			g_ptr_array_add ( batch, entry );
+
+			// The first batch is small and flushed early, so that the first screen does not wait for the whole directory
+			if ( !load->refresh && ( batch->len >= limit || ( batch->len && g_get_monotonic_time () > flush ) ) )
+			{
+				// The first screen arrives already sorted; the rest is put in place once at the end
+				if ( batch->len == recs->len ) dir_load_sort_first ( batch, recs, load );
+
+				g_async_queue_push ( load->queue, batch );
+
+				batch = dir_load_batch_new ();
+				limit = LOAD_BATCH;
+				flush = g_get_monotonic_time () + LOAD_FLUSH;
+			}
+		}
+
+		gmf_dir_close ( dir );
+
+		if ( batch->len && batch->len == recs->len ) dir_load_sort_first ( batch, recs, load );
+
+		if ( batch->len && !load->refresh ) g_async_queue_push ( load->queue, batch ); else g_ptr_array_unref ( batch );
+
+		dir_load_sort_all ( recs, load );
+
+		g_array_free ( recs, TRUE );
+
+		if ( !load->search && !g_cancellable_is_cancelled ( load->cancellable ) ) load->cache = TRUE;
+	}
+
+	g_atomic_int_set ( &load->done, TRUE );
+
+	dir_load_unref ( load );
+
+	return NULL;
+}
+
+static void gmf_win_icon_load_end ( gboolean done, GmfWin *win )
+{
+	DirLoad *load = win->load;
+	win->load = NULL;
+
+	if ( !done )
+	{
+		if ( win->model_t ) g_object_unref ( win->model_t );
+		win->model_t = NULL;
+
+		dir_load_unref ( load );
+
+		return;
+	}
+
+	GtkTreeModel *model = gtk_icon_view_get_model ( win->icon_view );
+
+	int nums   = gtk_tree_model_iter_n_children ( win->model_t, NULL );
+	int nums_v = gtk_tree_model_iter_n_children ( model, NULL );
+
+	if ( load->order && nums > 1 )
+	{
+		gmf_dir_model_reorder ( GMF_DIR_MODEL ( win->model_t ), load->order );
+
+		if ( nums == nums_v ) gmf_dir_model_reorder ( GMF_DIR_MODEL ( model ), load->order );
+	}
+
+	if ( nums != nums_v ) gtk_icon_view_set_model ( win->icon_view, win->model_t );
+
+	g_object_unref ( win->model_t );
+	win->model_t = NULL;
+
+	// Thumbnails go into the shown model as they are decoded
+	if ( win->preview && nums ) gmf_icon_update_pixbuf_all ( gtk_icon_view_get_model ( win->icon_view ), win );
+
+	if ( load->cache ) gmf_dir_cache_insert ( load->list );
+
+	if ( load->error ) gmf_dialog_message ( "", load->error, GTK_MESSAGE_WARNING, GTK_WINDOW ( win ) );
+
+	dir_load_unref ( load );
+}
+
+// The rows a refresh left without a thumbnail: the running job does not know them, a new one takes over
+static void gmf_win_icon_refresh_thumbs ( GtkTreeModel *model, GmfWin *win )
+{
+	if ( win->thumb ) g_atomic_int_set ( &win->thumb->cancel, TRUE );
+
+	win->thumb = NULL;
+
+	gmf_icon_update_pixbuf_all ( model, win );
+}
+
+/* Apply a fresh listing to the shown model: rows gone from the disk are removed, changed rows go back
+ * to a placeholder, new files are inserted in place with one; the thumbnail job decodes them as after
+ * a load. Untouched rows keep their thumbnails and the view its scroll. */
+static gboolean gmf_win_icon_refresh_diff ( DirLoad *load, GmfWin *win )
+{
+	GtkTreeModel *tree_model = gtk_icon_view_get_model ( win->icon_view );
+	GmfDirModel *model = GMF_DIR_MODEL ( tree_model );
+
+	GPtrArray *entries = load->list->entries;
+	GHashTable *table = g_hash_table_new ( g_str_hash, g_str_equal );
+
+	uint i = 0; for ( i = 0; i < entries->len; i++ )
+	{
+		GmfDirEntry *entry = g_ptr_array_index ( entries, i );
+		g_hash_table_insert ( table, entry->name, entry );
+	}
+
+	GtkTreeIter iter;
+	int n = gtk_tree_model_iter_n_children ( tree_model, NULL ), r = 0;
+
+	uint matched = 0;
+	for ( r = 0; r < n; r++ )
+	{
+		gtk_tree_model_iter_nth_child ( tree_model, &iter, NULL, r );
+
+		if ( g_hash_table_contains ( table, gmf_dir_model_get_name ( model, &iter ) ) ) matched++;
+	}
+
+	// A large change costs the icon view more row by row than a rebuilt model
+	if ( ( (uint)n - matched ) + ( entries->len - matched ) > REFRESH_MAX ) { g_hash_table_unref ( table ); return FALSE; }
+
+	GdkPixbuf *pixbuf_dir  = gmf_win_icon_placeholder ( TRUE,  win );
+	GdkPixbuf *pixbuf_file = gmf_win_icon_placeholder ( FALSE, win );
+
+	uint pending = 0;
+
+	for ( r = n - 1; r >= 0; r-- )
+	{
+		gtk_tree_model_iter_nth_child ( tree_model, &iter, NULL, r );
+
+		const char *name = gmf_dir_model_get_name ( model, &iter );
+		GmfDirEntry *entry = g_hash_table_lookup ( table, name );
+
+		if ( !entry ) { gmf_dir_model_remove ( model, &iter ); continue; }
+
+		if ( gmf_dir_model_update ( model, &iter, entry, !win->preview, ( entry->is_dir ) ? pixbuf_dir : pixbuf_file ) ) pending++;
+
+		g_hash_table_remove ( table, entry->name );
+	}
+
+	for ( i = 0; i < entries->len && g_hash_table_size ( table ); i++ )
+	{
+		GmfDirEntry *entry = g_ptr_array_index ( entries, i );
+
+		if ( !g_hash_table_remove ( table, entry->name ) ) continue;
+
+		gmf_dir_model_insert ( model, gmf_icon_model_sort_pos ( entry, tree_model, win ), entry, !win->preview, ( entry->is_dir ) ? pixbuf_dir : pixbuf_file );
+
+		pending++;
+	}
+
+	if ( pixbuf_dir  ) g_object_unref ( pixbuf_dir  );
+	if ( pixbuf_file ) g_object_unref ( pixbuf_file );
+
+	g_hash_table_unref ( table );
+
+	if ( win->preview && pending ) gmf_win_icon_refresh_thumbs ( tree_model, win );
+
+	return TRUE;
+}
+
+static void gmf_win_icon_refresh_end ( GmfWin *win )
+{
+	DirLoad *load = win->load;
+	win->load = NULL;
+
+	if ( load->cache ) gmf_dir_cache_insert ( load->list );
+
+	// The listing is cached by now, so a rebuild does not read the directory again
+	if ( !load->error && !gmf_win_icon_refresh_diff ( load, win ) ) gmf_win_icon_open_dir_tm ( win );
+
+	if ( load->error ) gmf_dialog_message ( "", load->error, GTK_MESSAGE_WARNING, GTK_WINDOW ( win ) );
+
+	dir_load_unref ( load );
+}
+
+static gboolean gmf_win_icon_load_tick ( DirLoad *load, GmfWin *win )
+{
+	if ( !GTK_IS_WIDGET ( win->icon_view ) ) { gmf_win_icon_load_end ( FALSE, win ); return FALSE; }
+
+	gboolean done = g_atomic_int_get ( &load->done );
+
+	if ( load->refresh )
+	{
+		if ( done ) gmf_win_icon_refresh_end ( win );
+
+		return !done;
+	}
+
+	int64_t end = g_get_monotonic_time () + LOAD_BUDGET;
+
+	GtkTreeModel *model = gtk_icon_view_get_model ( win->icon_view );
+
+	while ( g_get_monotonic_time () < end )
+	{
+		if ( !load->batch ) { load->batch = g_async_queue_try_pop ( load->queue ); load->indx = 0; }
+
+		if ( !load->batch ) break;
+
+		GmfDirEntry *entry = g_ptr_array_index ( load->batch, load->indx );
+
+		GdkPixbuf *pixbuf = ( entry->is_dir ) ? load->pixbuf_dir : load->pixbuf_file;
+
+		// The attached model only receives the first rows: every insert into a shown model costs the icon view O(n)
+		if ( load->nums < LOAD_VIEW_MAX ) gmf_dir_model_insert ( GMF_DIR_MODEL ( model ), -1, entry, !win->preview, pixbuf );
+
+		gmf_dir_model_insert ( GMF_DIR_MODEL ( win->model_t ), -1, entry, !win->preview, pixbuf );
+
+		load->nums++;
+
+		if ( ++load->indx >= load->batch->len ) { g_ptr_array_unref ( load->batch ); load->batch = NULL; }
 	}
 
+	if ( done && !load->batch && g_async_queue_length ( load->queue ) == 0 ) { gmf_win_icon_load_end ( TRUE, win ); return FALSE; }
+
 	return TRUE;
 }
 
+static gboolean gmf_win_icon_load_timeout ( DirLoad *load )
+{
+	GmfWin *win = g_weak_ref_get ( &load->win );
+
+	// Superseded, or the window is gone: it has already let go of the load, only this reference is left
+	if ( !win || load->gen != win->gen ) { if ( win ) g_object_unref ( win ); dir_load_unref ( load ); return FALSE; }
+
+	// Held for the tick: the error dialog at the end runs a main loop of its own
+	gboolean ret = gmf_win_icon_load_tick ( load, win );
+
+	g_object_unref ( win );
+
+	return ret;
+}
+
+static void gmf_win_icon_refresh ( const char *path_dir, GmfWin *win )
+{
+	DirLoad *load = g_new0 ( DirLoad, 1 );
+
+	load->ref = 2;
+	load->path = g_strdup ( path_dir );
+	load->hidden = win->hidden;
+	load->sort   = win->sort_num;
+	load->refresh = TRUE;
+
+	load->gen = win->gen;
+	g_weak_ref_init ( &load->win, win );
+
+	load->queue = g_async_queue_new ();
+	load->cancellable = g_cancellable_new ();
+	load->list = gmf_dir_list_new ( path_dir, win->sort_num, win->hidden );
+
+	win->load = load;
+
+	GThread *thread = g_thread_new ( "dir-load", (GThreadFunc)dir_load_thread, load );
+	g_thread_unref ( thread );
+
+	g_timeout_add ( LOAD_TICK, (GSourceFunc)gmf_win_icon_load_timeout, load );
+}
+
+static void gmf_win_icon_open_dir ( const char *path_dir, const char *search, GmfWin *win )
+{
+	g_return_if_fail ( path_dir != NULL );
+
+	DirLoad *load = g_new0 ( DirLoad, 1 );
+
+	load->ref = 2;
+	load->path = g_strdup ( path_dir );
+	load->search = g_strdup ( search );
+	load->hidden = win->hidden;
+	load->sort   = win->sort_num;
+	load->first  = MAX ( gmf_icon_get_vis_items ( win ), 16 );
+
+	load->gen = win->gen;
+	g_weak_ref_init ( &load->win, win );
+
+	load->queue = g_async_queue_new ();
+	load->cancellable = g_cancellable_new ();
+
+	load->pixbuf_dir  = gmf_win_icon_placeholder ( TRUE,  win );
+	load->pixbuf_file = gmf_win_icon_placeholder ( FALSE, win );
+
+	win->load = load;
+	win->model_t = gmf_win_icon_create_model ( path_dir, win );
+
+	GtkTreeModel *model = gmf_win_icon_create_model ( path_dir, win );
+	gtk_icon_view_set_model ( win->icon_view, model );
+	g_object_unref ( model );
+
+	GmfDirList *list = ( search ) ? NULL : gmf_dir_cache_lookup ( path_dir, win->sort_num, win->hidden );
+
+	if ( list )
+	{
+		// A cached listing is already sorted: it goes straight to the models, no thread
+		GPtrArray *batch = g_ptr_array_sized_new ( list->entries->len );
+
+		uint i = 0; for ( i = 0; i < list->entries->len; i++ ) g_ptr_array_add ( batch, g_ptr_array_index ( list->entries, i ) );
+
+		if ( batch->len ) g_async_queue_push ( load->queue, batch ); else g_ptr_array_unref ( batch );
+
+		load->ref  = 1;
+		load->done = TRUE;
+		load->list = list;
+	}
+	else
+	{
+		load->list = gmf_dir_list_new ( path_dir, win->sort_num, win->hidden );
+
+		GThread *thread = g_thread_new ( "dir-load", (GThreadFunc)dir_load_thread, load );
+		g_thread_unref ( thread );
+	}
+
+	g_timeout_add ( LOAD_TICK, (GSourceFunc)gmf_win_icon_load_timeout, load );
+}
+
+/* Start a new generation: the running load and thumbnail job are cancelled and detached at once.
+ * Their timeouts see the old generation on the next tick and drop whatever arrived since. */
+static void gmf_win_icon_stop ( GmfWin *win )
+{
+	win->gen++;
+
+	if ( win->thumb ) g_atomic_int_set ( &win->thumb->cancel, TRUE );
+	if ( win->load  ) g_cancellable_cancel ( win->load->cancellable );
+
+	if ( win->model_t ) g_object_unref ( win->model_t );
+
+	win->load = NULL;
+	win->thumb = NULL;
+	win->model_t = NULL;
+}
+
+static gboolean gmf_win_icon_open_dir_idle ( GmfWin *win )
+{
+	win->open_id = 0;
+
+	if ( !GTK_IS_WIDGET ( win->icon_view ) ) return FALSE;
+
+	const char *search = NULL;
+	g_autofree char *path = g_file_get_path ( win->file );
+
+	if ( gtk_widget_is_visible ( GTK_WIDGET ( win->entry_search ) ) ) search = gtk_entry_get_text ( win->entry_search );
+
+	ulong len = ( search ) ? strlen ( search ) : 0;
+
+	if ( len == 0 )
+		gmf_win_icon_open_dir ( path, NULL, win );
+	else
+	{
+		g_autofree char *search_down = g_utf8_strdown ( search, -1 );
+
+		gmf_win_icon_open_dir ( path, search_down, win );
+	}
+
+	return FALSE;
+}
+
+// Several requests in one main loop iteration open the directory once
 static void gmf_win_icon_open_dir_tm ( GmfWin *win )
 {
-	win->break_t = TRUE;
+	gmf_win_icon_stop ( win );
 
-	g_timeout_add ( 80, (GSourceFunc)gmf_win_icon_open_dir_timeout, win );
+	if ( !win->open_id ) win->open_id = g_idle_add ( (GSourceFunc)gmf_win_icon_open_dir_idle, win );
 }
 
 static GdkPixbuf * gmf_icon_pixbuf_add_text ( const char *fsize, int icon_size, GdkPixbuf *pxbf )
@@ -1986,19 +3435,12 @@ static char * gmf_win_icon_get_siter_from_file ( GFile *file, GmfWin *win )
 	GtkTreeIter iter;
 	GtkTreeModel *model = gtk_icon_view_get_model ( win->icon_view );
 
-	gboolean valid = FALSE;
-
-	for ( valid = gtk_tree_model_get_iter_first ( model, &iter ); valid; valid = gtk_tree_model_iter_next ( model, &iter ) )
-	{
-		if ( !GTK_IS_WIDGET ( win->icon_view ) ) break;
-
-		char *path = NULL;
-		gtk_tree_model_get ( model, &iter, COL_PATH, &path, -1 );
+	g_autofree char *dir  = g_path_get_dirname  ( path_f );
+	g_autofree char *name = g_path_get_basename ( path_f );
 
-		if ( g_str_equal ( path, path_f ) ) { free ( path ); str = gtk_tree_model_get_string_from_iter ( model, &iter ); break; }
+	if ( !g_str_equal ( dir, gmf_dir_model_get_dir ( GMF_DIR_MODEL ( model ) ) ) ) return NULL;
 
-		free ( path );
-	}
+	if ( gmf_dir_model_find ( GMF_DIR_MODEL ( model ), name, &iter ) ) str = gtk_tree_model_get_string_from_iter ( model, &iter );
 
 	return str;
 }
@@ -2018,27 +3460,32 @@ static void gmf_win_icon_changed_file ( GFile *file, GmfWin *win )
 
 	if ( !gtk_tree_model_get_iter_from_string ( model, &iter, str ) ) return;
 
-	gboolean is_dir = FALSE, is_link = FALSE;
-	gtk_tree_model_get ( model, &iter, COL_IS_DIR, &is_dir, COL_IS_LINK, &is_link, -1 );
+	// One stat, for the size shown and the row's new cache key alike
+	GmfDirEntry *entry = gmf_dir_entry_new_for_path ( path );
 
-	if ( !is_dir )
+	if ( !entry->is_dir )
 	{
-		ulong size = get_file_size ( path );
-		char *fsize = g_format_size ( size );
+		char *fsize = g_format_size ( entry->size );
 
 		GtkIconTheme *itheme = gtk_icon_theme_get_default ();
 
-		GdkPixbuf *pxbf = ( win->preview ) ? gmf_win_icon_get_pixbuf ( path, is_link, win->icon_size ) 
-			: gtk_icon_theme_load_icon ( itheme, ( is_dir ) ? "folder" : "text-x-preview", win->icon_size, GTK_ICON_LOOKUP_FORCE_REGULAR, NULL );
+		IconFile ifile;
+		gmf_win_icon_file_init_entry ( path, entry, win->icon_size, win->scale, &ifile );
 
-		GdkPixbuf *pixbuf = ( pxbf ) ? gmf_icon_pixbuf_add_text ( fsize, win->icon_size, pxbf ) : NULL;
+		GdkPixbuf *pxbf = ( win->preview ) ? gmf_win_icon_get_pixbuf ( &ifile ) 
+			: gtk_icon_theme_load_icon_for_scale ( itheme, ( entry->is_dir ) ? "folder" : "text-x-preview", win->icon_size, win->scale, GTK_ICON_LOOKUP_FORCE_REGULAR, NULL );
 
-		if ( pixbuf ) gtk_list_store_set ( GTK_LIST_STORE ( model ), &iter, COL_PIXBUF, pixbuf, COL_IS_PIXBUF, TRUE, -1 );
+		GdkPixbuf *pixbuf = ( pxbf ) ? gmf_icon_pixbuf_add_text ( fsize, win->icon_size * win->scale, pxbf ) : NULL;
+
+		// The row takes the new size and mtime too: a later thumbnail job keys on them
+		if ( pixbuf && !gmf_dir_model_update ( GMF_DIR_MODEL ( model ), &iter, entry, TRUE, pixbuf ) ) gmf_dir_model_set_pixbuf ( GMF_DIR_MODEL ( model ), &iter, pixbuf );
 
 		if ( fsize  ) free ( fsize );
 		if ( pxbf   ) g_object_unref ( pxbf );
 		if ( pixbuf ) g_object_unref ( pixbuf );
 	}
+
+	gmf_dir_entry_free ( entry );
 }
 
 static void gmf_icon_model_rm_file ( GFile *file, GmfWin *win )
@@ -2056,7 +3503,7 @@ static void gmf_icon_model_rm_file ( GFile *file, GmfWin *win )
 
 	if ( !gtk_tree_model_get_iter_from_string ( model, &iter, str ) ) return;
 
-	gtk_list_store_remove ( GTK_LIST_STORE ( model ), &iter );
+	gmf_dir_model_remove ( GMF_DIR_MODEL ( model ), &iter );
 }
 
 static void gmf_icon_model_mv_file ( GFile *file, GFile *new_file, GmfWin *win )
@@ -2070,6 +3517,8 @@ static void gmf_win_icon_changed_monitor ( UNUSED GFileMonitor *monitor, GFile *
 {
 	if ( !GTK_IS_WIDGET ( win->icon_view ) ) return;
 
+	if ( evtype != G_FILE_MONITOR_EVENT_CREATED && evtype != G_FILE_MONITOR_EVENT_MOVED_IN ) gmf_win_launcher_icon_forget ( file );
+
 	gboolean changed = FALSE;
 
 	switch ( evtype )
@@ -2136,79 +3585,14 @@ static void gmf_win_icon_selection_changed ( UNUSED GtkIconView *icon_view, GmfW
 	g_timeout_add ( 1000, (GSourceFunc)gmf_win_icon_changed_timeout, win );
 }
 
-static int gmf_win_icon_sort_func_az_sz ( gboolean a_z, gboolean sz, gboolean sz_ud, GtkTreeModel *model, GtkTreeIter *a, GtkTreeIter *b )
-{
-	int ret = 1;
-	gboolean is_dir_a, is_dir_b;
-
-	g_autofree char *name_a = NULL;
-	g_autofree char *name_b = NULL;
-
-	gtk_tree_model_get ( model, a, COL_IS_DIR, &is_dir_a, COL_NAME, &name_a, -1 );
-	gtk_tree_model_get ( model, b, COL_IS_DIR, &is_dir_b, COL_NAME, &name_b, -1 );
-
-	if ( !is_dir_a && is_dir_b )
-		ret = 1;
-	else if ( is_dir_a && !is_dir_b )
-		ret = -1;
-	else
-	{
-		if ( sz )
-		{
-			uint64_t size_a = 0, size_b = 0;
-			gtk_tree_model_get ( model, a, COL_SIZE, &size_a, -1 );
-			gtk_tree_model_get ( model, b, COL_SIZE, &size_b, -1 );
-
-			ret = ( sz_ud ) ? ( ( size_a >= size_b ) ? 1 : 0 ) : ( ( size_a <= size_b ) ? 1 : 0 );
-		}
-		else
-		{
-			g_autofree char *na = g_utf8_collate_key_for_filename ( name_a, -1 );
-			g_autofree char *nb = g_utf8_collate_key_for_filename ( name_b, -1 );
-
-			ret = ( a_z ) ? g_strcmp0 ( na, nb ) : g_strcmp0 ( nb, na );
-		}
-	}
-
-	return ret;
-}
-
-static int gmf_win_icon_sort_func_a_z ( GtkTreeModel *model, GtkTreeIter *a, GtkTreeIter *b, UNUSED gpointer data )
-{
-	return gmf_win_icon_sort_func_az_sz ( TRUE, FALSE, FALSE, model, a, b );
-}
-
-static int gmf_win_icon_sort_func_z_a ( GtkTreeModel *model, GtkTreeIter *a, GtkTreeIter *b, UNUSED gpointer data )
-{
-	return gmf_win_icon_sort_func_az_sz ( FALSE, FALSE, FALSE, model, a, b );
-}
-
-static int gmf_win_icon_sort_func_m_g ( GtkTreeModel *model, GtkTreeIter *a, GtkTreeIter *b, UNUSED gpointer data )
-{
-	return gmf_win_icon_sort_func_az_sz ( FALSE, TRUE, TRUE, model, a, b );
-}
-
-static int gmf_win_icon_sort_func_g_m ( GtkTreeModel *model, GtkTreeIter *a, GtkTreeIter *b, UNUSED gpointer data )
-{
-	return gmf_win_icon_sort_func_az_sz ( FALSE, TRUE, FALSE, model, a, b );
-}
-
-static void gmf_win_icon_set_sort_func ( enum sort_enm sort_num, GtkListStore *store, UNUSED GmfWin *win )
-{
-	if ( sort_num == SORT_AZ ) gtk_tree_sortable_set_default_sort_func ( GTK_TREE_SORTABLE ( store ), gmf_win_icon_sort_func_a_z, NULL, NULL );
-	if ( sort_num == SORT_ZA ) gtk_tree_sortable_set_default_sort_func ( GTK_TREE_SORTABLE ( store ), gmf_win_icon_sort_func_z_a, NULL, NULL );
-	if ( sort_num == SORT_MG ) gtk_tree_sortable_set_default_sort_func ( GTK_TREE_SORTABLE ( store ), gmf_win_icon_sort_func_m_g, NULL, NULL );
-	if ( sort_num == SORT_GM ) gtk_tree_sortable_set_default_sort_func ( GTK_TREE_SORTABLE ( store ), gmf_win_icon_sort_func_g_m, NULL, NULL );
-}
-
-static GtkTreeModel * gmf_win_icon_create_model ( GmfWin *win )
+static GtkTreeModel * gmf_win_icon_create_model ( const char *dir, GmfWin *win )
 {
-	GtkListStore *store = gtk_list_store_new ( NUM_COLS, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_BOOLEAN, G_TYPE_BOOLEAN, G_TYPE_BOOLEAN, GDK_TYPE_PIXBUF, G_TYPE_UINT64 );
+	// Unsorted: the loader sorts off the main thread and reorders the model once
+	GmfDirModel *model = gmf_dir_model_new ( dir );
 
-	gmf_win_icon_set_sort_func ( win->sort_num, store, win );
-	gtk_tree_sortable_set_sort_column_id ( GTK_TREE_SORTABLE (store), GTK_TREE_SORTABLE_DEFAULT_SORT_COLUMN_ID, GTK_SORT_ASCENDING );
+	gmf_dir_model_set_scale ( model, win->scale );
 
-	return GTK_TREE_MODEL ( store );
+	return GTK_TREE_MODEL ( model );
 }
 
 static GtkIconView * gmf_win_icon_view_create ( GmfWin *win )
@@ -2216,14 +3600,18 @@ static GtkIconView * gmf_win_icon_view_create ( GmfWin *win )
 	GtkIconView *icon_view = (GtkIconView *)gtk_icon_view_new ();
 	gtk_widget_set_visible ( GTK_WIDGET ( icon_view ), TRUE );
 
-	GtkTreeModel *model = gmf_win_icon_create_model ( win );
+	GtkTreeModel *model = gmf_win_icon_create_model ( NULL, win );
 	gtk_icon_view_set_model ( icon_view, model );
 
 	g_object_unref ( model );
 
 	gtk_icon_view_set_item_width    ( icon_view, ITEM_WIDTH );
 	gtk_icon_view_set_text_column   ( icon_view, COL_NAME   );
-	gtk_icon_view_set_pixbuf_column ( icon_view, COL_PIXBUF );
+
+	// Surfaces rather than the pixbuf column: pixbufs are in device pixels, a surface carries the scale to draw them at
+	GtkCellRenderer *renderer = gtk_cell_renderer_pixbuf_new ();
+	gtk_cell_layout_pack_start ( GTK_CELL_LAYOUT ( icon_view ), renderer, FALSE );
+	gtk_cell_layout_add_attribute ( GTK_CELL_LAYOUT ( icon_view ), renderer, "surface", COL_SURFACE );
 
 	gtk_icon_view_set_selection_mode ( icon_view, GTK_SELECTION_MULTIPLE );
 
@@ -2290,7 +3678,7 @@ static gboolean gmf_win_check_script ( GFile *file )
 {
 	gboolean ret = FALSE;
 
-	GFileInfo *file_info = g_file_query_info ( file, "standard::*", 0, NULL, NULL );
+	GFileInfo *file_info = g_file_query_info ( file, G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE, 0, NULL, NULL );
 
 	if ( !file_info ) return ret;
 
@@ -2415,7 +3803,10 @@ static void gmf_changed_icons ( GtkFileChooserButton *button, GmfWin *win )
 
 	g_object_set ( gtk_settings_get_default (), "gtk-icon-theme-name", name, NULL );
 
-	gmf_win_rld ( win );
+	gmf_win_icon_memo_clear ();
+	gmf_pixbuf_cache_clear ();
+
+	gmf_win_icon_open_dir_tm ( win );
 }
 
 static GtkFileChooserButton * gmf_win_create_theme ( const char *title, const char *path, void ( *f )( GtkFileChooserButton *, GmfWin * ), GmfWin *win )
@@ -2487,9 +3878,7 @@ static void gmf_win_changed_sort ( GtkComboBoxText *combo_box, GmfWin *win )
 	if ( num == 2 ) win->sort_num = SORT_MG;
 	if ( num == 3 ) win->sort_num = SORT_GM;
 
-	GtkListStore *store = GTK_LIST_STORE ( gtk_icon_view_get_model ( win->icon_view ) );
-
-	gmf_win_icon_set_sort_func ( win->sort_num, store, win );
+	gmf_win_icon_open_dir_tm ( win );
 }
 
 static GtkComboBoxText * gmf_win_create_combo_sort ( GmfWin *win )
@@ -2509,13 +3898,72 @@ static GtkComboBoxText * gmf_win_create_combo_sort ( GmfWin *win )
 	return combo;
 }
 
+/* A new icon size or scale for the rows already listed: the folder is not read again. Placeholders go in at once,
+ * the thumbnail job then scales down whatever is in memory at a bigger size and decodes only the rest. */
+static void gmf_win_icon_resize ( GtkTreeModel *model, GmfWin *win )
+{
+	uint start = 0, end = 0;
+
+	gboolean shown = gmf_win_icon_view_rows ( win, &start, &end );
+
+	gmf_win_icon_stop ( win );
+
+	GdkPixbuf *pixbuf_dir  = gmf_win_icon_placeholder ( TRUE,  win );
+	GdkPixbuf *pixbuf_file = gmf_win_icon_placeholder ( FALSE, win );
+
+	g_object_ref ( model );
+
+	gmf_dir_model_set_scale ( GMF_DIR_MODEL ( model ), win->scale );
+	gmf_dir_model_reset_pixbufs ( GMF_DIR_MODEL ( model ), !win->preview, pixbuf_dir, pixbuf_file );
+
+	// Every cell changes size: one relayout for the whole model instead of a row-changed per row
+	gtk_icon_view_set_model ( win->icon_view, NULL );
+	gtk_icon_view_set_model ( win->icon_view, model );
+
+	if ( shown )
+	{
+		GtkTreePath *path = gtk_tree_path_new_from_indices ( (int)start, -1 );
+		gtk_icon_view_scroll_to_path ( win->icon_view, path, TRUE, 0, 0 );
+		gtk_tree_path_free ( path );
+	}
+
+	if ( win->preview && gtk_tree_model_iter_n_children ( model, NULL ) ) gmf_icon_update_pixbuf_all ( model, win );
+
+	g_object_unref ( model );
+
+	if ( pixbuf_dir  ) g_object_unref ( pixbuf_dir  );
+	if ( pixbuf_file ) g_object_unref ( pixbuf_file );
+}
+
+static void gmf_win_icon_size_changed ( GmfWin *win )
+{
+	GtkTreeModel *model = gtk_icon_view_get_model ( win->icon_view );
+
+	// Still loading: the listing is not all there, so the folder is opened again
+	if ( !model || win->load || win->model_t || win->open_id ) { gmf_win_icon_open_dir_tm ( win ); return; }
+
+	gmf_win_icon_resize ( model, win );
+}
+
 static void gmf_win_changed_size ( GtkComboBoxText *combo_box, GmfWin *win )
 {
 	g_autofree char *text = gtk_combo_box_text_get_active_text ( combo_box );
 
 	win->icon_size = ( uint16_t )atoi ( text );
 
-	gmf_win_rld ( win );
+	gmf_win_icon_size_changed ( win );
+}
+
+// Dragged to a monitor with another scale: every pixbuf is made again at the new resolution
+static void gmf_win_icon_notify_scale ( GtkWidget *widget, UNUSED GParamSpec *pspec, GmfWin *win )
+{
+	uint8_t scale = (uint8_t)gtk_widget_get_scale_factor ( widget );
+
+	if ( scale == win->scale ) return;
+
+	win->scale = scale;
+
+	gmf_win_icon_size_changed ( win );
 }
 
 static uint8_t gmf_win_get_size_num ( GmfWin *win )
@@ -2552,7 +4000,7 @@ static void gmf_clicked_preview ( GtkButton *button, GmfWin *win )
 	GtkImage *image = (GtkImage *)gtk_button_get_image ( button );
 	gtk_image_set_from_icon_name ( image, ( win->preview ) ? "desktop" : "folder", GTK_ICON_SIZE_MENU );
 
-	gmf_win_rld ( win );
+	gmf_win_icon_open_dir_tm ( win );
 }
 
 static GtkPopover * gmf_win_popover_pref ( GmfWin *win )
@@ -2656,6 +4104,11 @@ static void gmf_win_set_pref ( GmfWin *win )
 	win->width  = (uint16_t)g_settings_get_uint ( settings, "width"  );
 	win->height = (uint16_t)g_settings_get_uint ( settings, "height" );
 
+	gmf_dir_cache_set_size ( g_settings_get_uint ( settings, "dir-cache" ) );
+	gmf_pixbuf_cache_set_budget ( g_settings_get_uint ( settings, "pixbuf-cache" ) );
+
+	win->thumb_mb = g_settings_get_uint ( settings, "thumb-memory" );
+
 	g_autofree char *theme      = g_settings_get_string  ( settings, "theme" );
 	g_autofree char *icon_theme = g_settings_get_string  ( settings, "icon-theme" );
 
@@ -2738,6 +4191,14 @@ static void gmf_win_destroy ( UNUSED GtkWindow *window, GmfWin *win )
 		g_cancellable_cancel ( win->cancellable_copy );
 	G_UNLOCK ( copy_th );
 
+	if ( win->open_id ) g_source_remove ( win->open_id );
+	win->open_id = 0;
+
+	if ( win->scroll_id ) g_source_remove ( win->scroll_id );
+	win->scroll_id = 0;
+
+	gmf_win_icon_stop ( win );
+
 	gtk_icon_view_unselect_all ( win->icon_view );
 }
 
@@ -2770,13 +4231,19 @@ static void gmf_win_create ( GmfWin *win )
 	win->scw = (GtkScrolledWindow *)gtk_scrolled_window_new ( NULL, NULL );
 	gtk_scrolled_window_set_policy ( win->scw, GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC );
 
+	win->scale = (uint8_t)MAX ( 1, gtk_widget_get_scale_factor ( GTK_WIDGET ( win ) ) );
+
 	win->icon_view = gmf_win_icon_view_create ( win );
 	g_signal_connect ( win->icon_view, "item-activated",     G_CALLBACK ( gmf_win_icon_item_activated    ), win );
 	g_signal_connect ( win->icon_view, "button-press-event", G_CALLBACK ( gmf_win_icon_press_event       ), win );
 	g_signal_connect ( win->icon_view, "selection-changed",  G_CALLBACK ( gmf_win_icon_selection_changed ), win );
+	g_signal_connect ( win->icon_view, "size-allocate",      G_CALLBACK ( gmf_win_icon_size_allocate     ), win );
+	g_signal_connect ( win->icon_view, "notify::scale-factor", G_CALLBACK ( gmf_win_icon_notify_scale    ), win );
 
 	gtk_container_add ( GTK_CONTAINER ( win->scw ), GTK_WIDGET ( win->icon_view ) );
 
+	g_signal_connect ( gtk_scrolled_window_get_vadjustment ( win->scw ), "value-changed", G_CALLBACK ( gmf_win_icon_scroll_changed ), win );
+
 	gtk_widget_set_visible ( GTK_WIDGET ( win->psb ), TRUE );
 	gtk_widget_set_visible ( GTK_WIDGET ( win->scw ), TRUE );
 
@@ -2816,15 +4283,18 @@ static void gmf_win_init ( GmfWin *win )
 
 	win->opacity = 100;
 	win->icon_size = 48;
+	win->scale = 1;
 
 	win->hidden = FALSE;
 	win->preview = TRUE;
+	win->thumb_mb = 128;
 	win->unmount_set_home = FALSE;
 
 	win->done_copy = TRUE;
 	win->list_err_copy = NULL;
 	win->cancellable_copy = g_cancellable_new ();
 
+	win->load = NULL;
 	win->monitor = NULL;
 	win->model_t = NULL;
 